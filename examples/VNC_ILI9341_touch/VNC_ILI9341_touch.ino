@@ -98,25 +98,14 @@ void setup(void) {
     touch.setCalibration(350, 550, 3550, 3600); // may need to be changed
 
     touch.onChange(6, 200, [](bool press, uint16_t x, uint16_t y, uint16_t z) {
-        static unsigned long lastUpdateP;
-        static unsigned long lastUpdateR;
+        // no throttling needed, the VNC client sends only the last motion per loop()
         static uint16_t lx, ly;
         if(z > 600) {
-            if((millis() - lastUpdateP) > 20) {
-                vnc.mouseEvent(x, y, 0b001);
-                lx = x;
-                ly = y;
-                lastUpdateP = millis();
-                Serial.printf("[Touch] press: 1 X: %d Y: %d Z: %d\n", x, y, z);
-            }
-            lastUpdateR = 0;
+            vnc.mouseEvent(x, y, 0b001);
+            lx = x;
+            ly = y;
         } else {
-            if((millis() - lastUpdateR) > 20) {
-                vnc.mouseEvent(lx, ly, 0b000);
-                lastUpdateR = millis();
-                Serial.printf("[Touch] press: 0 X: %d Y: %d Z: %d\n", lx, ly, z);
-            }
-            lastUpdateP = 0;
+            vnc.mouseEvent(lx, ly, 0b000);
         }
     });
 
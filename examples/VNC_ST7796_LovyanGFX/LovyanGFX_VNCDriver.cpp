@@ -2,12 +2,14 @@
 #ifdef ESP32
 VNCDriver::VNCDriver(LGFX *lgfx) {
   _lcd = lgfx;
+  _dma = NULL;
   _lcd->setRotation(1);
   _lcd->setBrightness(255);
   _lcd->fillScreen(TFT_BLACK);
 }
 
 VNCDriver::~VNCDriver() {
+  dma_complete();
 }
 
 bool VNCDriver::hasCopyRect(void) {
@@ -23,10 +25,34 @@ uint32_t VNCDriver::getWidth(void) {
 }
 
 void VNCDriver::draw_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *data) {
+  dma_complete();
   _lcd->pushImage(x, y, w, h, (uint16_t *)data);
 }
 
+// the SPI transfer runs while the client decodes the next tile into the other buffer
+void VNCDriver::submit_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *data, vnc_area_completion_t *done) {
+  dma_complete();
+  _lcd->startWrite();
+  _lcd->pushImageDMA(x, y, w, h, (uint16_t *)data);
+  _dma = done;
+}
+
+void VNCDriver::wait_area(vnc_area_completion_t *done) {
+  dma_complete();
+}
+
+// finish the running transfer before anything else is sent to the panel
+void VNCDriver::dma_complete(void) {
+  if (_dma) {
+    _lcd->waitDMA();
+    _lcd->endWrite();
+    _dma->busy = false;
+    _dma = NULL;
+  }
+}
+
 void VNCDriver::draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color) {
+  dma_complete();
   _lcd->fillRect(x, y, w, h, ((((color)&0xff) << 8) | (((color) >> 8))));
 }
 
@@ -34,6 +60,7 @@ void VNCDriver::copy_rect(uint32_t src_x, uint32_t src_y, uint32_t dest_x, uint3
 }
 
 void VNCDriver::area_update_start(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+  dma_complete();
   _lcd->setAddrWindow(x, y, w, h);
 }
 
@@ -49,7 +76,18 @@ void VNCDriver::vnc_options_override(dfb_vnc_options *opt) {
   opt->client.bigendian = 1;
 }
 
+bool VNCDriver::hasReadArea(void) {
+  return true;
+}
+
+// save-under of the soft cursor, same byte order as draw_area
+void VNCDriver::read_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *data) {
+  dma_complete();
+  _lcd->readRect(x, y, w, h, (uint16_t *)data);
+}
+
 void VNCDriver::print_screen(String title, String msg, int color) {
+  dma_complete();
   _lcd->fillScreen(TFT_BLACK);
   _lcd->setCursor(0, _lcd->height() / 3);
   _lcd->setTextColor(color);
@@ -60,6 +98,7 @@ void VNCDriver::print_screen(String title, String msg, int color) {
 }
 
 void VNCDriver::print(String text) {
+  dma_complete();
   _lcd->print(text);
 }
 #endif
\ No newline at end of file
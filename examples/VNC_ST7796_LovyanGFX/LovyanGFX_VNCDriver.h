@@ -96,6 +96,8 @@ public:
   uint32_t getHeight(void);
   uint32_t getWidth(void);
   void draw_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t* data);
+  void submit_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t* data, vnc_area_completion_t* done);
+  void wait_area(vnc_area_completion_t* done);
   void draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color);
   void copy_rect(uint32_t src_x, uint32_t src_y, uint32_t dest_x, uint32_t dest_y, uint32_t w, uint32_t h);
   void area_update_start(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
@@ -103,10 +105,16 @@ public:
   void area_update_end(void);
 
   void vnc_options_override(dfb_vnc_options* opt);
+
+  bool hasReadArea(void);
+  void read_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t* data);
   void print_screen(String title, String msg, int color);
   void print(String text);
 
 private:
   LGFX* _lcd;
+  vnc_area_completion_t* _dma;
+
+  void dma_complete(void);
 };
 #endif
\ No newline at end of file
@@ -54,22 +54,92 @@ arduinoVNC::arduinoVNC(VNCdisplay * _display) {
     sock = 0;
     protocolMinorVersion = 3;
     onlyFullUpdate = false;
+    updateDepth = VNC_UPDATE_PIPELINE_DEPTH;
+    updatesPending = 0;
+    lastUpdateReceived = 0;
+    updateDelay = 0;
+    updateFails = 0;
+    connectStartUs = 0;
+    reconnectMs = 0;
+    reconnectDelay = 0;
+    handshakeState = VNC_HANDSHAKE_VERSION;
+    handshakeMs = 0;
+    handshakeLength = 0;
+    loopBudgetUs = 0;
+    fbuActive = false;
+    fbuLastRect = false;
+    fbuRects = 0;
+    fbuRect = 0;
+    desktopWidth = desktopHeight = 0;
+    desktopScreenId = 0;
+    desktopRequested = false;
+    cutTextCb = NULL;
+    cutTextArg = NULL;
+    cutTextMax = VNC_CUTTEXT_MAX;
+    cutTextLength = 0;
+    cutTextOffset = 0;
+    clipboardText = NULL;
+#ifdef VNC_ARENA
+    clipboardBuffer = NULL;
+#endif
+    clipboardLength = 0;
+    clipboardOffset = 0;
+    clipboardHoldLength = 0;
+    clipboardHoldReserve = 0;
+    txLength = 0;
+    inputFlushMs = 0;
+    pointerQueued = false;
+    pointerSent = false;
+    pointerSentButtons = 0;
+    pool = &ownPool;
+    fillCount = 0;
+#ifdef FPS_BENCHMARK
+    statsEnabled = true;
+#else
+    statsEnabled = false;
+#endif
+    resetStats();
+    _rate_reset();
+    _encoding_reset();
+    cuSupported = false;
+    fenceSupported = false;
+    cuEnabled = false;
+    cuPaused = false;
+    cuStopPending = false;
+    fencePending = false;
+    cuFramesInFlight = 0;
 #ifdef VNC_RICH_CURSOR
-    richCursorData = NULL;
-    richCursorMask = NULL;
+    cursorBuffer = NULL;
+    cursorBufferSize = 0;
+    cursorPixels = NULL;
+    cursorBytesPerPixel = 2;
+    cursorMask = NULL;
+    cursorSave = NULL;
+    cursorImage = NULL;
+    cursorRuns = NULL;
+    cursorRunCount = 0;
+    cursorW = cursorH = 0;
+    cursorHotX = cursorHotY = 0;
+    cursorX = cursorY = 0;
+    cursorShown = false;
 #endif
 }
 
 arduinoVNC::~arduinoVNC(void) {
     TCPclient.stop();
+    _clipboard_free();
 #ifdef VNC_RICH_CURSOR
-    if(richCursorData) {
-        freeSec(richCursorData);
-    }
-    if(richCursorMask) {
-        freeSec(richCursorMask);
+    SoftCursorFree();
+#endif
+#ifndef VNC_ARENA
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    if(!inflateExternal) {
+        freeSec(zin);
+        freeSec(zout);
     }
 #endif
+#endif
+    freeSec(opt.server.name);
 }
 
 void arduinoVNC::begin(char *_host, uint16_t _port, bool _onlyFullUpdate) {
@@ -120,6 +190,10 @@ void arduinoVNC::begin(char *_host, uint16_t _port, bool _onlyFullUpdate) {
 
     display->vnc_options_override(&opt);
 
+#ifdef VNC_ARENA
+    _arena_init();
+#endif
+
     setMaxFPS(100);
 }
 
@@ -148,9 +222,6 @@ void arduinoVNC::setPassword(String pass) {
 
 void arduinoVNC::loop(void) {
 
-    static uint16_t fails = 0;
-    static unsigned long lastUpdate = 0;
-
 #if defined(ESP8266) || defined(ESP32)
     if(WiFi.status() != WL_CONNECTED) {
         if(connected()) {
@@ -161,49 +232,89 @@ void arduinoVNC::loop(void) {
 #endif
 
     if(!connected()) {
+        if(reconnectDelay && (millis() - reconnectMs) < reconnectDelay) {
+            return;
+        }
         DEBUG_VNC("!connected\n");
+#ifdef VNC_ARENA
+        // without the arena the decoders would fall back to the heap
+        if(!_arena_init()) {
+            _reconnect_failed();
+            return;
+        }
+#endif
+        connectStartUs = micros();
         if(!rfb_connect_to_server(host.c_str(), port)) {
             DEBUG_VNC("Couldnt establish connection with the VNC server. Exiting\n");
-            delay(500);
+            _reconnect_failed();
             return;
         }
 
-        /* initialize the connection */
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+        // the server starts new Zlib and ZRLE streams
+        inflateEncoding = 0;
+#endif
+        // the encodings are sent during the handshake
+        _encoding_reset();
+
+        cuSupported = false;
+        fenceSupported = false;
+        cuEnabled = false;
+        cuPaused = false;
+        cuStopPending = false;
+        fencePending = false;
+        cuFramesInFlight = 0;
+
+        updatesPending = 0;
+        updateFails = 0;
+        fbuActive = false;
+        cutTextLength = 0;
+        cutTextOffset = 0;
+        _clipboard_free();
+        clipboardHoldLength = 0;
+        clipboardHoldReserve = 0;
+        pointerQueued = false;
+        pointerSent = false;
+        pointerSentButtons = 0;
+
+        handshakeState = VNC_HANDSHAKE_VERSION;
+        handshakeMs = millis();
+    }
+
+    if(handshakeState != VNC_HANDSHAKE_DONE) {
+        /* initialize the connection, pixel format and encodings included */
         if(!rfb_initialise_connection()) {
             DEBUG_VNC("Connection with VNC server couldnt be initialized. Exiting\n");
             disconnect();
-            delay(500);
-            return;
-        }
-
-        /* Tell the VNC server which pixel format and encodings we want to use */
-        if(!rfb_set_format_and_encodings()) {
-            DEBUG_VNC("Error negotiating format and encodings. Exiting.\n");
-            disconnect();
-            delay(500);
+            _reconnect_failed();
             return;
         }
 
-#ifdef SET_DESKTOP_SIZE
-        /* set display resolution */
-        if (!rfb_set_desktop_size()) {
-            DEBUG_VNC("Error set desktop size. Exiting.\n");
-            disconnect();
-            delay(500);
+        if(handshakeState != VNC_HANDSHAKE_DONE) {
+            // waiting for the server, the next loop() continues
+            if(!_tx_flush()) {
+                disconnect();
+                _reconnect_failed();
+            }
             return;
         }
-#endif
+        reconnectDelay = 0;
+        stats.connectUs = micros() - connectStartUs;
 
         /* calculate horizontal and vertical offset */
-        if(opt.client.width > opt.server.width) {
-            opt.h_offset = rint((opt.client.width - opt.server.width) / 2);
-        }
-        if(opt.client.height > opt.server.height) {
-            opt.v_offset = rint((opt.client.height - opt.server.height) / 2);
-        }
+        _desktop_offsets();
 
         mousestate.x = opt.client.width / 2;
         mousestate.y = opt.client.height / 2;
+#ifdef VNC_RICH_CURSOR
+        // the screen is redrawn, the server sends the shape again
+        cursorShown = false;
+        cursorX = mousestate.x;
+        cursorY = mousestate.y;
+#endif
+
+        lastUpdateReceived = millis();
+        _rate_reset();
 
         // no scale support for embedded systems!
         opt.h_ratio = 1; //(double) opt.client.width / (double) opt.server.width;
@@ -211,70 +322,261 @@ void arduinoVNC::loop(void) {
 
 
         rfb_send_update_request(0);
-        //rfb_set_continuous_updates(1);
 
         DEBUG_VNC("vnc_connect Done.\n");
 
 #if defined(VNC_ZLIB) || defined(VNC_ZRLE)
-        if (!zin) {
-            zin = (uint8_t *)malloc(ZRLE_INPUT_BUFFER);
-        }
-        if (!zin) {
-            DEBUG_VNC("zin_buffer malloc failed!\n");
-        }
+        if(!inflateExternal) {
+            if (!zin) {
+                zin = (uint8_t *)vnc_malloc(VNC_MEM_ZLIB, ZRLE_INPUT_BUFFER);
+            }
+            if (!zin) {
+                DEBUG_VNC("zin_buffer malloc failed!\n");
+                disconnect();
+                _reconnect_failed();
+                return;
+            }
 
-        if (!zout) {
-            zout = (uint8_t *)malloc(ZRLE_OUTPUT_BUFFER);
-        }
-        if (!zout) {
-            DEBUG_VNC("zout malloc failed!\n");
+            if (!zout) {
+                zout = (uint8_t *)vnc_malloc(VNC_MEM_ZLIB, ZRLE_OUTPUT_BUFFER);
+            }
+            if (!zout) {
+                DEBUG_VNC("zout malloc failed!\n");
+                disconnect();
+                _reconnect_failed();
+                return;
+            }
         }
 
-        tinfl_init(&inflator);
-        // reset dict
-        memset(zout, 0, ZRLE_OUTPUT_BUFFER);
-        zout_next = zout;
-
-#ifdef VNC_ZRLE
-        zout_read = zout;
-#endif // #ifdef VNC_ZRLE
-
+        _inflate_reset();
 #endif
 
     } else {
+        if(clipboardText && !_clipboard_send(VNC_CLIPBOARD_CHUNK)) {
+            disconnect();
+            return;
+        }
+
+        // pointer motion waits for the clipboard text, it can not be nested into it
+        if(pointerQueued && !clipboardText && (millis() - inputFlushMs) >= VNC_INPUT_INTERVAL) {
+            inputFlushMs = millis();
+            if(!_input_commit_pointer()) {
+                disconnect();
+                return;
+            }
+        }
+
+        // input first, decoding a FramebufferUpdate can take a while
+        if(!_tx_flush()) {
+            disconnect();
+            return;
+        }
+
         if(!rfb_handle_server_message()) {
             //DEBUG_VNC("rfb_handle_server_message failed.\n");
             return;
         }
 
-        if((millis() - lastUpdate) > updateDelay) {
+        if(updatesPending && (millis() - lastUpdateReceived) > VNC_UPDATE_TIMEOUT) {
+            // server merged or dropped requests
+            updatesPending = 0;
+            rttProbeUs = 0;
+            lastUpdateReceived = millis();
+        }
+
+#ifdef VNC_ADAPTIVE_ENCODING
+        if((millis() - lastEncodingCheck) > VNC_ENCODING_CHECK_INTERVAL) {
+            lastEncodingCheck = millis();
+            if(!_encoding_adapt()) {
+                disconnect();
+                return;
+            }
+        }
+#endif
+
+        // keep the pipeline filled, with continuous updates the server pushes the data
+        if(!cuEnabled && !cuPaused && updatesPending < (onlyFullUpdate ? 1 : rate.depth) && (micros() - lastRequestUs) >= rate.requestIntervalUs) {
             if(rfb_send_update_request(onlyFullUpdate ? 0 : 1)) {
-                lastUpdate = millis();
-                fails = 0;
+                lastRequestUs = micros();
+                updateFails = 0;
             } else {
-                fails++;
-                if(fails > 20) {
+                updateFails++;
+                if(updateFails > 20) {
                     disconnect();
                 }
             }
         }
     }
+
+    if(!_tx_flush()) {
+        disconnect();
+    }
 #ifdef SLOW_LOOP
     delay(SLOW_LOOP);
 #endif
 }
 
+/**
+ * wait before the next connect attempt, the first retry after a working session is immediate
+ */
+void arduinoVNC::_reconnect_failed(void) {
+    connectStartUs = 0;
+    reconnectMs = millis();
+    reconnectDelay = reconnectDelay ? min(reconnectDelay * 2, VNC_RECONNECT_MAX) : VNC_RECONNECT_MIN;
+}
+
 int arduinoVNC::forceFullUpdate(void) {
+    if(handshakeState != VNC_HANDSHAKE_DONE) {
+        return false;
+    }
     return rfb_send_update_request(0);
 }
 
+/**
+ * write queued input and messages now instead of in the next loop()
+ */
+bool arduinoVNC::flush(void) {
+    if(!connected() || handshakeState != VNC_HANDSHAKE_DONE) {
+        return false;
+    }
+    if(!_input_commit_pointer() || !_tx_flush()) {
+        disconnect();
+        return false;
+    }
+    return true;
+}
+
+/**
+ * receive the clipboard of the server, at most maxLength bytes of each ServerCutText are passed on
+ */
+void arduinoVNC::setCutTextCallback(vnc_cut_text_cb_t cb, void * arg, uint32_t maxLength) {
+    cutTextCb = cb;
+    cutTextArg = arg;
+    cutTextMax = maxLength;
+}
+
+/**
+ * send text (Latin-1) to the clipboard of the server, the text is copied
+ * and sent in VNC_CLIPBOARD_CHUNK pieces by loop(), false while a previous text is sent
+ * or if it is longer then VNC_CLIPBOARD_MAX
+ */
+bool arduinoVNC::sendClipboard(const char * text, size_t len) {
+    if(!connected() || handshakeState != VNC_HANDSHAKE_DONE || clipboardText) {
+        return false;
+    }
+
+    if(len > VNC_CLIPBOARD_MAX) {
+        DEBUG_VNC("[sendClipboard] text to long: %d\n", (int) len);
+        return false;
+    }
+
+    rfbClientCutTextMsg cct;
+    cct.type = rfbClientCutText;
+    cct.pad1 = 0;
+    cct.pad2 = 0;
+    cct.length = Swap32IfLE(len);
+
+    if(len) {
+#ifdef VNC_ARENA
+        clipboardText = clipboardBuffer;
+#else
+        clipboardText = (uint8_t *) vnc_malloc(VNC_MEM_CUTTEXT, len);
+#endif
+        if(!clipboardText) {
+            DEBUG_VNC("[sendClipboard] no memory!\n");
+            return false;
+        }
+        memcpy(clipboardText, text, len);
+    }
+
+    if(!_tx_write((uint8_t *) &cct, sz_rfbClientCutTextMsg)) {
+        _clipboard_free();
+        return false;
+    }
+    clipboardLength = len;
+    clipboardOffset = 0;
+    return true;
+}
+
+bool arduinoVNC::sendClipboard(const char * text) {
+    return sendClipboard(text, strlen(text));
+}
+
+bool arduinoVNC::sendClipboard(String text) {
+    return sendClipboard(text.c_str(), text.length());
+}
+
+/**
+ * send the next max bytes of the clipboard text, the messages held back follow the last one
+ */
+bool arduinoVNC::_clipboard_send(size_t max) {
+    size_t len = min((size_t) (clipboardLength - clipboardOffset), max);
+    if(!_tx_write(clipboardText + clipboardOffset, len)) {
+        return false;
+    }
+    clipboardOffset += len;
+    if(clipboardOffset < clipboardLength) {
+        return true;
+    }
+    _clipboard_free();
+    len = clipboardHoldLength;
+    clipboardHoldLength = 0;
+    clipboardHoldReserve = 0;
+    return _tx_write(clipboardHold, len);
+}
+
+/**
+ * true if a message of n bytes can be written without waiting for the clipboard text,
+ * only a key release may use the room reserved for it
+ */
+bool arduinoVNC::_clipboard_hold_room(size_t n, bool release) {
+    size_t reserve = release ? 0 : clipboardHoldReserve;
+    return !clipboardText || (clipboardHoldLength + reserve + n) <= sizeof(clipboardHold);
+}
+
+void arduinoVNC::_clipboard_free(void) {
+#ifdef VNC_ARENA
+    // clipboardBuffer stays in the arena
+    clipboardText = NULL;
+#else
+    freeSec(clipboardText);
+#endif
+}
+
 void arduinoVNC::setOffset(uint16_t x, uint16_t y) {
+#ifdef VNC_RICH_CURSOR
+    SoftCursorHide();
+#endif
     opt.h_offset = x;
     opt.v_offset = y;
+#ifdef VNC_RICH_CURSOR
+    SoftCursorShow();
+#endif
+    if(cuEnabled) {
+        // move the continuous updates area
+        rfb_set_continuous_updates(true);
+    }
 }
 
 void arduinoVNC::setMaxFPS(uint16_t fps) {
     updateDelay = (1000/fps);
+    rate.requestIntervalUs = (uint32_t) updateDelay * 1000;
+}
+
+/**
+ * number of FramebufferUpdateRequests to keep outstanding,
+ * more then one hides the round trip time when the server does not support continuous updates
+ */
+void arduinoVNC::setPipelineDepth(uint8_t depth) {
+    updateDepth = max(depth, (uint8_t) 1);
+    rate.depth = min(rate.depth, updateDepth);
+}
+
+/**
+ * current estimates of the rate controller
+ */
+vnc_rate_t arduinoVNC::getRateEstimates(void) {
+    return rate;
 }
 
 
@@ -303,6 +605,21 @@ bool arduinoVNC::connected(void) {
 #endif
 }
 
+/**
+ * server data is waiting or a FramebufferUpdate is only partly decoded, the next loop() continues
+ */
+bool arduinoVNC::pending(void) {
+    return connected() && (fbuActive || TCPclient.available());
+}
+
+/**
+ * time after which loop() stops decoding a FramebufferUpdate, checked before each rect.
+ * the rest is decoded by the next loop() calls, 0 decodes the whole update at once
+ */
+void arduinoVNC::setLoopBudget(uint32_t us) {
+    loopBudgetUs = us;
+}
+
 //#############################################################################################
 //                                       TCP handling
 //#############################################################################################
@@ -311,6 +628,7 @@ bool arduinoVNC::connected(void) {
 
 bool arduinoVNC::read_from_rfb_server(int sock, char *out, size_t n) {
     unsigned long t = millis();
+    unsigned long waitStart = 0;
     size_t len;
     /*
      DEBUG_VNC("read_from_rfb_server %d...\n", n);
@@ -337,15 +655,28 @@ bool arduinoVNC::read_from_rfb_server(int sock, char *out, size_t n) {
         }
 
         if(!TCPclient.available()) {
+            if(!waitStart) {
+                // the server may wait for our messages
+                if(!_tx_flush()) {
+                    return false;
+                }
+                waitStart = micros() | 1;
+            }
             delay(0);
             continue;
         }
 
+        if(waitStart) {
+            frameNetworkUs += (micros() - waitStart);
+            waitStart = 0;
+        }
+
         len = TCPclient.read((uint8_t*) out, n);
         if(len) {
             t = millis();
             out += len;
             n -= len;
+            frameBytes += len;
             //DEBUG_VNC("Receive %d left %d!\n", len, n);
         } else {
             //DEBUG_VNC("Receive %d left %d!\n", len, n);
@@ -355,7 +686,25 @@ bool arduinoVNC::read_from_rfb_server(int sock, char *out, size_t n) {
     return true;
 }
 
+/**
+ * drain n bytes from the server without using them (data of invisible areas)
+ */
+bool arduinoVNC::skip_from_rfb_server(int sock, size_t n) {
+    char buf[256];
+    while(n > 0) {
+        size_t len = min(n, sizeof(buf));
+        if(!read_from_rfb_server(sock, buf, len)) {
+            return false;
+        }
+        n -= len;
+    }
+    return true;
+}
+
 #ifdef VNC_ZRLE
+/**
+ * read n decompressed bytes, out can be NULL to skip the data
+ */
 bool arduinoVNC::read_from_z(uint8_t *out, size_t n) {
     // Make our life a bit easier
     if(n > ZRLE_OUTPUT_BUFFER) {
@@ -376,8 +725,10 @@ bool arduinoVNC::read_from_z(uint8_t *out, size_t n) {
         if(buf_size < n) {
             DEBUG_VNC_ZRLE("[read_from_z] Partially in buffer: %d of %d\n", buf_size, n);
             // Data is only partially available
-            memcpy(out, zout_read, buf_size);
-            out += buf_size;
+            if(out) {
+                memcpy(out, zout_read, buf_size);
+                out += buf_size;
+            }
             n -= buf_size;
             zout_read = zout_next;
         }  else {
@@ -405,7 +756,9 @@ bool arduinoVNC::read_from_z(uint8_t *out, size_t n) {
         size_t bytes_decompressed = zout + ZRLE_OUTPUT_BUFFER - zout_next;
         size_t bytes_consumed = bytes_available;
         // We cannot decompress into "out" directly, because it would have to have at least ZRLE_OUTPUT_BUFFER capacity
+        VNC_TRACE_EVENT(VNC_TRACE_INFLATE_START, 0, 0, 0, 0, bytes_available);
         tinfl_status last_status = tinfl_decompress(&inflator, zin_next, &bytes_consumed, zout, zout_next, &bytes_decompressed, TINFL_FLAG_HAS_MORE_INPUT | TINFL_FLAG_PARSE_ZLIB_HEADER);
+        VNC_TRACE_EVENT(VNC_TRACE_INFLATE_END, 0, 0, 0, 0, bytes_decompressed);
         bytes_available -= bytes_consumed;
         zin_next += bytes_consumed;
 
@@ -415,8 +768,10 @@ bool arduinoVNC::read_from_z(uint8_t *out, size_t n) {
         }
 
         if(bytes_decompressed < n) {
-            memcpy(out, zout_read, bytes_decompressed);
-            out += bytes_decompressed;
+            if(out) {
+                memcpy(out, zout_read, bytes_decompressed);
+                out += bytes_decompressed;
+            }
             n -= bytes_decompressed;
             zout_read = zout_next;
         } else {
@@ -431,7 +786,9 @@ bool arduinoVNC::read_from_z(uint8_t *out, size_t n) {
     }
 
     // Copy data from decompression buffer into "out"
-    memcpy(out, zout_read, n);
+    if(out) {
+        memcpy(out, zout_read, n);
+    }
     zout_read += n;
 
     if (zout_read >= zout + ZRLE_OUTPUT_BUFFER) {
@@ -440,6 +797,44 @@ bool arduinoVNC::read_from_z(uint8_t *out, size_t n) {
 
     return true;
 }
+
+/**
+ * inflate the rest of the current message into the dictionary only
+ */
+bool arduinoVNC::skip_from_z(void) {
+    while(bytes_available || msg_bytes_remain) {
+        if(!bytes_available) {
+            bytes_available = min(msg_bytes_remain, (size_t)ZRLE_INPUT_BUFFER);
+            if (!read_from_rfb_server(sock, (char *)zin, bytes_available)) {
+                DEBUG_VNC("[skip_from_z] Failed reading from socket %d!\n", bytes_available);
+                return false;
+            }
+            msg_bytes_remain -= bytes_available;
+            zin_next = zin;
+        }
+
+        size_t bytes_decompressed = zout + ZRLE_OUTPUT_BUFFER - zout_next;
+        size_t bytes_consumed = bytes_available;
+        VNC_TRACE_EVENT(VNC_TRACE_INFLATE_START, 0, 0, 0, 0, bytes_available);
+        tinfl_status last_status = tinfl_decompress(&inflator, zin_next, &bytes_consumed, zout, zout_next, &bytes_decompressed, TINFL_FLAG_HAS_MORE_INPUT | TINFL_FLAG_PARSE_ZLIB_HEADER);
+        VNC_TRACE_EVENT(VNC_TRACE_INFLATE_END, 0, 0, 0, 0, bytes_decompressed);
+        bytes_available -= bytes_consumed;
+        zin_next += bytes_consumed;
+
+        zout_next += bytes_decompressed;
+        if (zout_next >= zout + ZRLE_OUTPUT_BUFFER) {
+            zout_next = zout;
+        }
+
+        if(last_status < TINFL_STATUS_DONE || (!bytes_consumed && !bytes_decompressed)) {
+            DEBUG_VNC("[skip_from_z] Error during decompression: %d\n", last_status);
+            return false;
+        }
+    }
+
+    zout_read = zout_next;
+    return true;
+}
 #endif // #ifdef VNC_ZRLE
 
 bool arduinoVNC::write_exact(int sock, char *buf, size_t n) {
@@ -447,7 +842,49 @@ bool arduinoVNC::write_exact(int sock, char *buf, size_t n) {
         DEBUG_VNC("[write_exact] not connected!\n");
         return false;
     }
-    return (TCPclient.write((uint8_t*) buf, n) == n);
+    // messages can not be nested, they wait behind a ClientCutText in progress
+    if(clipboardText) {
+        // key events are checked by rfb_send_key_event, a release may use the reserve
+        if(_clipboard_hold_room(n, ((uint8_t) buf[0] == rfbKeyEvent))) {
+            memcpy(&clipboardHold[clipboardHoldLength], buf, n);
+            clipboardHoldLength += n;
+            return true;
+        }
+        // no room, finish the text first, input never gets here
+        if(!_clipboard_send(clipboardLength)) {
+            return false;
+        }
+    }
+    return _tx_write((uint8_t*) buf, n);
+}
+
+/**
+ * collect data in txBuffer, sent by _tx_flush
+ */
+bool arduinoVNC::_tx_write(const uint8_t * buf, size_t n) {
+    if((txLength + n) > VNC_TX_BUFFER) {
+        if(!_tx_flush()) {
+            return false;
+        }
+    }
+    if(n > VNC_TX_BUFFER) {
+        return (TCPclient.write(buf, n) == n);
+    }
+    memcpy(&txBuffer[txLength], buf, n);
+    txLength += n;
+    return true;
+}
+
+bool arduinoVNC::_tx_flush(void) {
+    if(!txLength) {
+        return true;
+    }
+    size_t len = txLength;
+    txLength = 0;
+    if(!connected()) {
+        return false;
+    }
+    return (TCPclient.write(txBuffer, len) == len);
 }
 
 bool arduinoVNC::set_non_blocking(int sock) {
@@ -473,8 +910,17 @@ void arduinoVNC::disconnect(void) {
  * ConnectToRFBServer.
  */
 bool arduinoVNC::rfb_connect_to_server(const char *host, int port) {
+    txLength = 0;
 #ifdef USE_ARDUINO_TCP
+    // an unreachable server must not block loop() for long
+#ifdef ESP32
+    if(!TCPclient.connect(host, port, VNC_CONNECT_TIMEOUT)) {
+#else
+#ifdef ESP8266
+    TCPclient.setTimeout(VNC_CONNECT_TIMEOUT);
+#endif
     if(!TCPclient.connect(host, port)) {
+#endif
         DEBUG_VNC("[rfb_connect_to_server] Connect error\n");
         return false;
     }
@@ -529,35 +975,71 @@ bool arduinoVNC::rfb_connect_to_server(const char *host, int port) {
 #endif
 }
 
+/**
+ * run the handshake as far as the received data allows, never waits for the server.
+ * ClientInit, SetPixelFormat and SetEncodings are sent together with the security handshake,
+ * the server reads them after SecurityResult and ServerInit, this saves two round trips
+ */
 bool arduinoVNC::rfb_initialise_connection() {
-    if(!_rfb_negotiate_protocol()) {
-        DEBUG_VNC("[rfb_initialise_connection] _rfb_negotiate_protocol()  Failed!\n");
-        return false;
-    }
-
-    if(!_rfb_authenticate()) {
-        DEBUG_VNC("[rfb_initialise_connection] _rfb_authenticate()  Failed!\n");
-        return false;
-    }
-
-    if(!_rfb_initialise_client()) {
-        DEBUG_VNC("[rfb_initialise_connection] _rfb_initialise_client()  Failed!\n");
-        return false;
-    }
+    uint8_t state;
+    bool progress = false;
+
+    do {
+        state = handshakeState;
+        bool result = false;
+        switch(handshakeState) {
+            case VNC_HANDSHAKE_VERSION:
+                result = _rfb_negotiate_protocol();
+                break;
+            case VNC_HANDSHAKE_SECURITY:
+            case VNC_HANDSHAKE_SECURITY_TYPES:
+            case VNC_HANDSHAKE_CHALLENGE:
+                result = _rfb_authenticate();
+                break;
+            case VNC_HANDSHAKE_REASON:
+            case VNC_HANDSHAKE_REASON_TEXT:
+                result = _read_conn_failed_reason();
+                break;
+            case VNC_HANDSHAKE_RESULT:
+                result = _read_authentication_result();
+                break;
+            case VNC_HANDSHAKE_SERVER_INIT:
+            case VNC_HANDSHAKE_SERVER_NAME:
+                result = _rfb_initialise_server();
+                break;
+        }
+        if(!result) {
+            DEBUG_VNC("[rfb_initialise_connection] handshake failed in state %d!\n", state);
+            return false;
+        }
+        progress |= (handshakeState != state);
+    } while(handshakeState != state && handshakeState != VNC_HANDSHAKE_DONE);
 
-    if(!_rfb_initialise_server()) {
-        DEBUG_VNC("[rfb_initialise_connection] _rfb_initialise_server() Failed!\n");
+    if(progress) {
+        handshakeMs = millis();
+    } else if((millis() - handshakeMs) > VNC_TCP_TIMEOUT) {
+        DEBUG_VNC("[rfb_initialise_connection] receive TIMEOUT!\n");
         return false;
     }
-
     return true;
 }
 
+/**
+ * true if n bytes of the next handshake message are received
+ */
+bool arduinoVNC::_handshake_available(size_t n) {
+    return (size_t) TCPclient.available() >= n;
+}
+
 bool arduinoVNC::_rfb_negotiate_protocol() {
     uint16_t server_major, server_minor;
 
     rfbProtocolVersionMsg msg;
 
+    if(!_handshake_available(sz_rfbProtocolVersionMsg)) {
+        return true;
+    }
+
     /* read the protocol version the server uses */
     if(!read_from_rfb_server(sock, (char*) &msg, sz_rfbProtocolVersionMsg))
         return false;
@@ -597,37 +1079,52 @@ bool arduinoVNC::_rfb_negotiate_protocol() {
         return false;
     }
 
+    handshakeState = VNC_HANDSHAKE_SECURITY;
     return true;
 }
 
+/**
+ * length and text of the reason, the connection fails in any case
+ */
 bool arduinoVNC::_read_conn_failed_reason(void) {
-    CARD32 reason_length;
-    CARD8 *reason_string;
-    DEBUG_VNC("[_read_conn_failed_reason] Connection to VNC server failed\n");
+    if(handshakeState == VNC_HANDSHAKE_REASON) {
+        CARD32 reason_length;
+        if(!_handshake_available(sizeof(CARD32))) {
+            return true;
+        }
+        if(!read_from_rfb_server(sock, (char *) &reason_length, sizeof(CARD32))) {
+            return false;
+        }
+        handshakeLength = Swap32IfLE(reason_length);
+        handshakeState = VNC_HANDSHAKE_REASON_TEXT;
+    }
 
-    if(!read_from_rfb_server(sock, (char *) &reason_length, sizeof(CARD32))) {
-        return false;
+    if(!_handshake_available(handshakeLength)) {
+        return true;
     }
 
-    reason_length = Swap32IfLE(reason_length);
-    reason_string = (CARD8 *) malloc(sizeof(CARD8) * reason_length);
+    DEBUG_VNC("[_read_conn_failed_reason] Connection to VNC server failed\n");
 
+    CARD8 *reason_string = (CARD8 *) vnc_malloc(VNC_MEM_PROTOCOL, sizeof(CARD8) * handshakeLength + 1);
     if(!reason_string) {
         return false;
     }
 
-    if(!read_from_rfb_server(sock, (char *) reason_string, reason_length)) {
-        freeSec(reason_string);
-        return false;
+    if(read_from_rfb_server(sock, (char *) reason_string, handshakeLength)) {
+        reason_string[handshakeLength] = 0x00;
+        DEBUG_VNC("[_read_conn_failed_reason] Errormessage: %s\n", reason_string);
     }
-
-    DEBUG_VNC("[_read_conn_failed_reason] Errormessage: %s\n", reason_string);
     freeSec(reason_string);
-    return true;
+    return false;
 }
 
 bool arduinoVNC::_read_authentication_result(void) {
     CARD32 auth_result;
+
+    if(!_handshake_available(4)) {
+        return true;
+    }
+
     if(!read_from_rfb_server(sock, (char*) &auth_result, 4)) {
         return false;
     }
@@ -642,6 +1139,7 @@ bool arduinoVNC::_read_authentication_result(void) {
             return false;
         case rfbAuthOK:
             DEBUG_VNC("Authentication OK\n");
+            handshakeState = VNC_HANDSHAKE_SERVER_INIT;
             return true;
         default:
             DEBUG_VNC("Unknown result of authentication: 0x%08X (%d)\n", auth_result, auth_result);
@@ -654,26 +1152,55 @@ bool arduinoVNC::_rfb_authenticate() {
     CARD32 authscheme;
     CARD8 challenge_and_response[CHALLENGESIZE];
 
-    if(protocolMinorVersion >= 7) {
-        CARD8 secType = rfbSecTypeInvalid;
+    if(handshakeState == VNC_HANDSHAKE_CHALLENGE) {
+        if(!_handshake_available(CHALLENGESIZE)) {
+            return true;
+        }
 
-        CARD8 nSecTypes;
+        if(!read_from_rfb_server(sock, (char *) challenge_and_response, CHALLENGESIZE)) {
+            return false;
+        }
+
+        vncEncryptBytes(challenge_and_response, opt.password);
+        if(!write_exact(sock, (char *) challenge_and_response, CHALLENGESIZE)) {
+            return false;
+        }
+        return _rfb_initialise_client(true);
+    }
+
+    if(protocolMinorVersion >= 7) {
+        CARD8 secType = rfbSecTypeInvalid;
+
+        CARD8 nSecTypes;
         CARD8 *secTypes;
 
         CARD8 knownSecTypes[] = { rfbSecTypeNone, rfbSecTypeVncAuth };
         uint8_t nKnownSecTypes = sizeof(knownSecTypes);
 
-        if(!read_from_rfb_server(sock, (char *) &nSecTypes, sizeof(nSecTypes))) {
-            return false;
-        }
+        if(handshakeState == VNC_HANDSHAKE_SECURITY) {
+            if(!_handshake_available(sizeof(nSecTypes))) {
+                return true;
+            }
 
-        if(nSecTypes == 0) {
-            if(!_read_conn_failed_reason()) {
+            if(!read_from_rfb_server(sock, (char *) &nSecTypes, sizeof(nSecTypes))) {
                 return false;
             }
+
+            if(nSecTypes == 0) {
+                handshakeState = VNC_HANDSHAKE_REASON;
+                return true;
+            }
+
+            handshakeLength = nSecTypes;
+            handshakeState = VNC_HANDSHAKE_SECURITY_TYPES;
+        }
+
+        nSecTypes = handshakeLength;
+        if(!_handshake_available(nSecTypes)) {
+            return true;
         }
 
-        secTypes = (CARD8 *) malloc(nSecTypes);
+        secTypes = (CARD8 *) vnc_malloc(VNC_MEM_PROTOCOL, nSecTypes);
 
         if(!secTypes) {
             return false;
@@ -720,14 +1247,16 @@ bool arduinoVNC::_rfb_authenticate() {
         authscheme = secType;
     } else {
         // protocol Minor < 7
+        if(!_handshake_available(4)) {
+            return true;
+        }
         if(!read_from_rfb_server(sock, (char *) &authscheme, 4)) {
             return false;
         }
         authscheme = Swap32IfLE(authscheme);
         if(authscheme == rfbSecTypeInvalid) {
-            if(!_read_conn_failed_reason()) {
-                return false;
-            }
+            handshakeState = VNC_HANDSHAKE_REASON;
+            return true;
         }
     }
 
@@ -736,10 +1265,7 @@ bool arduinoVNC::_rfb_authenticate() {
             return false;
             break;
         case rfbSecTypeNone:
-            if(protocolMinorVersion >= 8) {
-                return _read_authentication_result();
-            }
-            return true;
+            return _rfb_initialise_client(protocolMinorVersion >= 8);
             break;
         case rfbSecTypeTight:
 #ifdef VNC_SEC_TYPE_TIGHT
@@ -754,71 +1280,96 @@ bool arduinoVNC::_rfb_authenticate() {
                 return false;
             }
 
-            if(!read_from_rfb_server(sock, (char *) challenge_and_response, CHALLENGESIZE)) {
-                return false;
-            }
-
-            vncEncryptBytes(challenge_and_response, opt.password);
-            if(!write_exact(sock, (char *) challenge_and_response, CHALLENGESIZE)) {
-                return false;
-            }
-            return _read_authentication_result();
+            handshakeState = VNC_HANDSHAKE_CHALLENGE;
+            return true;
             break;
     }
 
     return false;
 }
 
-bool arduinoVNC::_rfb_initialise_client() {
+/**
+ * ClientInit and the pixel format and encodings, result is set if a SecurityResult follows
+ */
+bool arduinoVNC::_rfb_initialise_client(bool result) {
     rfbClientInitMsg cl;
     cl.shared = opt.shared;
     if(!write_exact(sock, (char *) &cl, sz_rfbClientInitMsg)) {
         return false;
     }
 
+    /* Tell the VNC server which pixel format and encodings we want to use */
+    if(!rfb_set_format_and_encodings()) {
+        DEBUG_VNC("[_rfb_initialise_client] rfb_set_format_and_encodings() Failed!\n");
+        return false;
+    }
+
+    handshakeState = result ? VNC_HANDSHAKE_RESULT : VNC_HANDSHAKE_SERVER_INIT;
     return true;
 }
 
 bool arduinoVNC::_rfb_initialise_server() {
-    int len;
     rfbServerInitMsg si;
 
-    if(!read_from_rfb_server(sock, (char *) &si, sz_rfbServerInitMsg)) {
-        return false;
-    }
-
-    opt.server.width = Swap16IfLE(si.framebufferWidth);
-    opt.server.height = Swap16IfLE(si.framebufferHeight);
+    if(handshakeState == VNC_HANDSHAKE_SERVER_INIT) {
+        if(!_handshake_available(sz_rfbServerInitMsg)) {
+            return true;
+        }
 
-    // never be bigger then the client!
-    opt.server.width = min(opt.client.width, opt.server.width);
-    opt.server.height = min(opt.client.height, opt.server.height);
+        if(!read_from_rfb_server(sock, (char *) &si, sz_rfbServerInitMsg)) {
+            return false;
+        }
 
-    opt.server.bpp = si.format.bitsPerPixel;
-    opt.server.depth = si.format.depth;
-    opt.server.bigendian = si.format.bigEndian;
-    opt.server.truecolour = si.format.trueColour;
+        opt.server.width = Swap16IfLE(si.framebufferWidth);
+        opt.server.height = Swap16IfLE(si.framebufferHeight);
+        desktopWidth = opt.server.width;
+        desktopHeight = opt.server.height;
+        desktopRequested = false;
+        desktopScreenId = 0;
+
+        // never be bigger then the client!
+        opt.server.width = min(opt.client.width, opt.server.width);
+        opt.server.height = min(opt.client.height, opt.server.height);
+
+        opt.server.bpp = si.format.bitsPerPixel;
+        opt.server.depth = si.format.depth;
+        opt.server.bigendian = si.format.bigEndian;
+        opt.server.truecolour = si.format.trueColour;
+
+        opt.server.redmax = Swap16IfLE(si.format.redMax);
+        opt.server.greenmax = Swap16IfLE(si.format.greenMax);
+        opt.server.bluemax = Swap16IfLE(si.format.blueMax);
+        opt.server.redshift = si.format.redShift;
+        opt.server.greenshift = si.format.greenShift;
+        opt.server.blueshift = si.format.blueShift;
+
+        DEBUG_VNC("[VNC-SERVER] VNC Server config\n");
+        DEBUG_VNC(" - width:%d      height:%d\n", desktopWidth, desktopHeight);
+        DEBUG_VNC(" - bpp:%d        depth:%d       bigendian:%d     truecolor:%d\n", opt.server.bpp, opt.server.depth, opt.server.bigendian, opt.server.truecolour);
+        DEBUG_VNC(" - redmax:%d     greenmax:%d    bluemax:%d\n", opt.server.redmax, opt.server.greenmax, opt.server.bluemax);
+        DEBUG_VNC(" - redshift:%d   greenshift:%d  blueshift:%d\n", opt.server.redshift, opt.server.greenshift, opt.server.blueshift);
+
+        handshakeLength = Swap32IfLE(si.nameLength);
+        handshakeState = VNC_HANDSHAKE_SERVER_NAME;
+    }
 
-    opt.server.redmax = Swap16IfLE(si.format.redMax);
-    opt.server.greenmax = Swap16IfLE(si.format.greenMax);
-    opt.server.bluemax = Swap16IfLE(si.format.blueMax);
-    opt.server.redshift = si.format.redShift;
-    opt.server.greenshift = si.format.greenShift;
-    opt.server.blueshift = si.format.blueShift;
+    if(!_handshake_available(handshakeLength)) {
+        return true;
+    }
 
-    len = Swap32IfLE(si.nameLength);
-    opt.server.name = (char *) malloc(sizeof(char) * len + 1);
+    freeSec(opt.server.name);
+    opt.server.name = (char *) vnc_malloc(VNC_MEM_PROTOCOL, sizeof(char) * handshakeLength + 1);
+    if(!opt.server.name) {
+        return false;
+    }
 
-    if(!read_from_rfb_server(sock, opt.server.name, len)) {
+    if(!read_from_rfb_server(sock, opt.server.name, handshakeLength)) {
         return false;
     }
-    opt.server.name[len] = 0x00;
+    opt.server.name[handshakeLength] = 0x00;
 
-    DEBUG_VNC("[VNC-SERVER] VNC Server config - Name: %s\n", opt.server.name);
-    DEBUG_VNC(" - width:%d      height:%d\n", Swap16IfLE(si.framebufferWidth), Swap16IfLE(si.framebufferHeight));
-    DEBUG_VNC(" - bpp:%d        depth:%d       bigendian:%d     truecolor:%d\n", opt.server.bpp, opt.server.depth, opt.server.bigendian, opt.server.truecolour);
-    DEBUG_VNC(" - redmax:%d     greenmax:%d    bluemax:%d\n", opt.server.redmax, opt.server.greenmax, opt.server.bluemax);
-    DEBUG_VNC(" - redshift:%d   greenshift:%d  blueshift:%d\n", opt.server.redshift, opt.server.greenshift, opt.server.blueshift);
+    DEBUG_VNC("[VNC-SERVER] Name: %s\n", opt.server.name);
+    handshakeState = VNC_HANDSHAKE_DONE;
     return true;
 }
 
@@ -827,10 +1378,7 @@ bool arduinoVNC::_rfb_initialise_server() {
 //#############################################################################################
 
 bool arduinoVNC::rfb_set_format_and_encodings() {
-    uint8_t num_enc = 0;
     rfbSetPixelFormatMsg pf;
-    rfbSetEncodingsMsg em;
-    CARD32 enc[MAX_ENCODINGS];
 
     pf.type = 0;
     pf.format.bitsPerPixel = opt.client.bpp;
@@ -848,67 +1396,73 @@ bool arduinoVNC::rfb_set_format_and_encodings() {
         return false;
     }
 
+    if(!rfb_set_encodings()) {
+        return false;
+    }
+
+    DEBUG_VNC("[VNC-CLIENT] Client pixel format:\n");
+    DEBUG_VNC(" - width:%d      height:%d\n", opt.client.width, opt.client.height);
+    DEBUG_VNC(" - bpp:%d        depth:%d        bigEndian:%d    trueColor:%d\n", opt.client.bpp, opt.client.depth, opt.client.bigendian, opt.client.truecolour);
+    DEBUG_VNC(" - red-max:%d    green-max:%d    blue-max:%d\n", opt.client.redmax, opt.client.greenmax, opt.client.bluemax);
+    DEBUG_VNC(" - red-shift:%d  green-shift:%d  blue-shift:%d\n", opt.client.redshift, opt.client.greenshift, opt.client.blueshift);
+
+    return true;
+}
+
+/**
+ * send the encodings in the current preference order, can be repeated at any time
+ */
+bool arduinoVNC::rfb_set_encodings() {
+    uint8_t num_enc = 0;
+    rfbSetEncodingsMsg em;
+    CARD32 enc[MAX_ENCODINGS];
+
     em.type = rfbSetEncodings;
 
     DEBUG_VNC("[VNC-CLIENT] Supported Encodings:\n");
-#ifdef VNC_ZRLE
-    enc[num_enc++] = Swap32IfLE(rfbEncodingZRLE);
-    DEBUG_VNC(" - ZRLE\n");
-#endif
-#ifdef VNC_TIGHT
-    enc[num_enc++] = Swap32IfLE(rfbEncodingTight);
-    DEBUG_VNC(" - Tight\n");
-#endif
-#ifdef VNC_HEXTILE
-    enc[num_enc++] = Swap32IfLE(rfbEncodingHextile);
-    DEBUG_VNC(" - Hextile\n");
-#endif
-#ifdef VNC_ZLIB
-    enc[num_enc++] = Swap32IfLE(rfbEncodingZlib);
-    DEBUG_VNC(" - Zlib\n");
-#endif
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        enc[num_enc++] = Swap32IfLE(encodings[i].encoding);
+        DEBUG_VNC(" - %d\n", encodings[i].encoding);
+    }
 
     if(display->hasCopyRect()) {
         enc[num_enc++] = Swap32IfLE(rfbEncodingCopyRect);
         DEBUG_VNC(" - CopyRect\n");
     }
 
-#ifdef VNC_RRE
-    enc[num_enc++] = Swap32IfLE(rfbEncodingRRE);
-    DEBUG_VNC(" - RRE\n");
-#endif
-#ifdef VNC_CORRE
-    enc[num_enc++] = Swap32IfLE(rfbEncodingCoRRE);
-    DEBUG_VNC(" - CoRRE\n");
-#endif
-
-    enc[num_enc++] = Swap32IfLE(rfbEncodingRaw);
-    DEBUG_VNC(" - Raw\n");
-
     DEBUG_VNC("[VNC-CLIENT] Supported Special Encodings:\n");
 
-#ifdef SET_DESKTOP_SIZE
+    enc[num_enc++] = Swap32IfLE(rfbEncodingExtendedDesktopSize);
+    DEBUG_VNC(" - ExtendedDesktopSize\n");
+
     enc[num_enc++] = Swap32IfLE(rfbEncodingNewFBSize);
-    DEBUG_VNC(" - SetDesktopSize\n");
-#endif
+    DEBUG_VNC(" - NewFBSize\n");
 
 #ifdef VNC_RICH_CURSOR
-    enc[num_enc++] = Swap32IfLE(rfbEncodingRichCursor);
-    DEBUG_VNC(" - RichCursor\n");
+    // without read back the server has to draw the cursor
+    if(display->hasReadArea()) {
+        enc[num_enc++] = Swap32IfLE(rfbEncodingRichCursor);
+        DEBUG_VNC(" - RichCursor\n");
 
-    enc[num_enc++] = Swap32IfLE(rfbEncodingXCursor);
-    DEBUG_VNC(" - XCursor\n");
+        enc[num_enc++] = Swap32IfLE(rfbEncodingXCursor);
+        DEBUG_VNC(" - XCursor\n");
+    }
 #endif
 
     enc[num_enc++] = Swap32IfLE(rfbEncodingPointerPos);
     DEBUG_VNC(" - CursorPos\n");
 
-    //enc[num_enc++] = Swap32IfLE(rfbEncodingLastRect);
-    //DEBUG_VNC(" - LastRect\n");
+    enc[num_enc++] = Swap32IfLE(rfbEncodingLastRect);
+    DEBUG_VNC(" - LastRect\n");
 
+#ifdef VNC_CONTINUOUS_UPDATES
     enc[num_enc++] = Swap32IfLE(rfbEncodingContinuousUpdates);
     DEBUG_VNC(" - ContinuousUpdates\n");
 
+    enc[num_enc++] = Swap32IfLE(rfbEncodingFence);
+    DEBUG_VNC(" - Fence\n");
+#endif
+
     if (opt.client.compresslevel <= 9) {
         enc[num_enc++] = Swap32IfLE(rfbEncodingCompressLevel0 + opt.client.compresslevel);
         DEBUG_VNC(" - compresslevel: %d\n", opt.client.compresslevel);
@@ -928,26 +1482,21 @@ bool arduinoVNC::rfb_set_format_and_encodings() {
         return false;
     }
 
-    DEBUG_VNC("[VNC-CLIENT] Client pixel format:\n");
-    DEBUG_VNC(" - width:%d      height:%d\n", opt.client.width, opt.client.height);
-    DEBUG_VNC(" - bpp:%d        depth:%d        bigEndian:%d    trueColor:%d\n", opt.client.bpp, opt.client.depth, opt.client.bigendian, opt.client.truecolour);
-    DEBUG_VNC(" - red-max:%d    green-max:%d    blue-max:%d\n", opt.client.redmax, opt.client.greenmax, opt.client.bluemax);
-    DEBUG_VNC(" - red-shift:%d  green-shift:%d  blue-shift:%d\n", opt.client.redshift, opt.client.greenshift, opt.client.blueshift);
-
     return true;
 }
 
 
 #ifdef SET_DESKTOP_SIZE
+/**
+ * ask the server for a framebuffer of the display size,
+ * only allowed after the server announced ExtendedDesktopSize
+ */
 bool arduinoVNC::rfb_set_desktop_size() {
     uint16_t w = opt.client.width;
     uint16_t h = opt.client.height;
 
     DEBUG_VNC("[rfb_set_desktop_size] setting desktop size to %dx%d\n", w, h);
-
-    // override server resolution
-    opt.server.width = w;
-    opt.server.height = h;
+    desktopRequested = true;
 
     w = Swap16IfLE(w);
     h = Swap16IfLE(h);
@@ -958,7 +1507,7 @@ bool arduinoVNC::rfb_set_desktop_size() {
     ds.height = h;
     ds.numScreens = 1;
     ds.pad2 = 0;
-    ds.layoutId = 1;
+    ds.layoutId = Swap32IfLE(desktopScreenId);
     ds.layoutX = 0;
     ds.layoutY = 0;
     ds.layoutWidth = w;
@@ -974,14 +1523,22 @@ bool arduinoVNC::rfb_set_desktop_size() {
 #endif
 
 bool arduinoVNC::rfb_send_update_request(int incremental) {
+    // a centered desktop starts at 0
+    return rfb_send_update_request(incremental, max(opt.v_offset, 0), max(opt.h_offset, 0), opt.server.width, opt.server.height);
+}
+
+/**
+ * request a part of the framebuffer, server coordinates
+ */
+bool arduinoVNC::rfb_send_update_request(int incremental, uint16_t x, uint16_t y, uint16_t w, uint16_t h) {
     rfbFramebufferUpdateRequestMsg urq = { 0 };
 
     urq.type = rfbFramebufferUpdateRequest;
     urq.incremental = incremental;
-    urq.x = opt.v_offset;
-    urq.y = opt.h_offset;
-    urq.w = opt.server.width;
-    urq.h = opt.server.height;
+    urq.x = x;
+    urq.y = y;
+    urq.w = w;
+    urq.h = h;
 
     urq.x = Swap16IfLE(urq.x);
     urq.y = Swap16IfLE(urq.y);
@@ -993,6 +1550,12 @@ bool arduinoVNC::rfb_send_update_request(int incremental) {
         return false;
     }
 
+    VNC_TRACE_EVENT(VNC_TRACE_REQUEST, x, y, w, h, incremental);
+    if(!updatesPending) {
+        rttProbeUs = micros() | 1;
+        rttProbeFull = !incremental && !clipboardText;
+    }
+    updatesPending++;
     return true;
 }
 
@@ -1001,8 +1564,8 @@ bool arduinoVNC::rfb_set_continuous_updates(bool enable) {
 
     urq.type = rfbEnableContinuousUpdates;
     urq.enable = enable;
-    urq.x = opt.v_offset;
-    urq.y = opt.h_offset;
+    urq.x = max(opt.v_offset, 0);
+    urq.y = max(opt.h_offset, 0);
     urq.w = opt.server.width;
     urq.h = opt.server.height;
 
@@ -1019,113 +1582,126 @@ bool arduinoVNC::rfb_set_continuous_updates(bool enable) {
     return true;
 }
 
+bool arduinoVNC::rfb_send_fence(CARD32 flags, uint8_t length, char * data) {
+    char buf[sz_rfbFenceMsg + 64];
+
+    if(length > 64) {
+        return false;
+    }
+
+    // rfbFenceMsg is padded in memory, build the message by hand
+    memset(buf, 0, sz_rfbFenceMsg);
+    buf[0] = rfbFence;
+    flags = Swap32IfLE(flags);
+    memcpy(&buf[4], &flags, sizeof(flags));
+    buf[8] = length;
+    if(length) {
+        memcpy(&buf[sz_rfbFenceMsg], data, length);
+    }
+
+    if(!write_exact(sock, buf, sz_rfbFenceMsg + length)) {
+        DEBUG_VNC("[rfb_send_fence] write_exact failed!\n");
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Fence request, the response is our round trip time sample
+ */
+bool arduinoVNC::rfb_send_fence_request(void) {
+    if(!rfb_send_fence(rfbFenceFlagRequest | rfbFenceFlagBlockBefore, 0, NULL)) {
+        return false;
+    }
+    fencePending = true;
+    fenceSentUs = micros() | 1;
+    return true;
+}
+
+/**
+ * enable continuous updates as soon as the server supports them and Fence
+ */
+bool arduinoVNC::_rfb_start_continuous_updates(void) {
+#ifdef VNC_CONTINUOUS_UPDATES
+    if(!cuSupported || !fenceSupported || cuEnabled || cuPaused || onlyFullUpdate) {
+        return true;
+    }
+
+    DEBUG_VNC("[_rfb_start_continuous_updates] enable continuous updates\n");
+    if(!rfb_set_continuous_updates(true)) {
+        return false;
+    }
+    cuEnabled = true;
+#endif
+    return true;
+}
+
+/**
+ * flow control for continuous updates.
+ * after every frame a Fence is sent if none is outstanding, its response tells us the server
+ * has seen everything we processed so far. If too many frames arrive before the Fence returns
+ * the client can not keep up and the updates are paused until the Fence is back.
+ */
+bool arduinoVNC::rfb_continuous_updates_frame_done(void) {
+    if(!fencePending) {
+        cuFramesInFlight = 0;
+        return rfb_send_fence_request();
+    }
+
+    cuFramesInFlight++;
+#ifdef VNC_CONTINUOUS_UPDATES
+    if(cuEnabled && cuFramesInFlight >= VNC_CU_MAX_FRAMES) {
+        DEBUG_VNC("[rfb_continuous_updates_frame_done] %d frames in flight, pause updates\n", cuFramesInFlight);
+        if(!rfb_set_continuous_updates(false)) {
+            return false;
+        }
+        cuEnabled = false;
+        cuPaused = true;
+        cuStopPending = true;
+    }
+#endif
+    return true;
+}
+
 bool arduinoVNC::rfb_handle_server_message() {
 
     rfbServerToClientMsg msg = { 0 };
-    rfbFramebufferUpdateRectHeader rectheader = { 0 };
+
+    if(cutTextOffset < cutTextLength) {
+        if(!_handle_server_cut_text_data()) {
+            disconnect();
+            return false;
+        }
+        return true;
+    }
+
+    if(fbuActive) {
+        return _handle_framebuffer_update_rects();
+    }
 
     if(TCPclient.available()) {
+        unsigned long messageStartUs = micros();
         if(!read_from_rfb_server(sock, (char*) &msg, 1)) {
             return false;
         }
+        VNC_TRACE_EVENT(VNC_TRACE_MESSAGE, 0, 0, 0, 0, msg.type);
         switch(msg.type) {
             case rfbFramebufferUpdate:
                 read_from_rfb_server(sock, ((char*) &msg.fu) + 1, sz_rfbFramebufferUpdateMsg - 1);
                 msg.fu.nRects = Swap16IfLE(msg.fu.nRects);
-                for(uint16_t i = 0; i < msg.fu.nRects; i++) {
-                    read_from_rfb_server(sock, (char*) &rectheader,
-                    sz_rfbFramebufferUpdateRectHeader);
-                    rectheader.r.x = Swap16IfLE(rectheader.r.x);
-                    rectheader.r.y = Swap16IfLE(rectheader.r.y);
-                    rectheader.r.w = Swap16IfLE(rectheader.r.w);
-                    rectheader.r.h = Swap16IfLE(rectheader.r.h);
-                    rectheader.encoding = Swap32IfLE(rectheader.encoding);
-                    //SoftCursorLockArea(rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
-
-#ifdef FPS_BENCHMARK
-                    unsigned long encodingStart = micros();
-#endif
-                    bool encodingResult = false;
-                    switch(rectheader.encoding) {
-                        case rfbEncodingRaw:
-                            encodingResult = _handle_raw_encoded_message(rectheader);
-                            break;
-                        case rfbEncodingCopyRect:
-                            encodingResult = _handle_copyrect_encoded_message(rectheader);
-                            break;
-#ifdef VNC_RRE
-                        case rfbEncodingRRE:
-                            encodingResult = _handle_rre_encoded_message(rectheader);
-                            break;
-#endif
-#ifdef VNC_CORRE
-                        case rfbEncodingCoRRE:
-                            encodingResult = _handle_corre_encoded_message(rectheader);
-                            break;
-#endif
-#ifdef VNC_HEXTILE
-                        case rfbEncodingHextile:
-                            encodingResult = _handle_hextile_encoded_message(rectheader);
-                            break;
-#endif
-#ifdef VNC_ZRLE
-                        case rfbEncodingZRLE:
-                            encodingResult = _handle_zrle_encoded_message(rectheader);
-                            break;
-#endif
-#ifdef VNC_TIGHT
-                            case rfbEncodingTight:
-                            encodingResult =_handle_tight_encoded_message(rectheader);
-                            break;
-#endif
-#ifdef VNC_ZLIB
-                            case rfbEncodingZlib:
-                            encodingResult =_handle_zlib_encoded_message(rectheader);
-                            break;
-#endif
-#ifdef VNC_RICH_CURSOR
-                            case rfbEncodingXCursor:
-                            case rfbEncodingRichCursor:
-                            encodingResult = _handle_richcursor_message(rectheader);
-                            break;
-#endif
-                        case rfbEncodingPointerPos:
-                            encodingResult = _handle_cursor_pos_message(rectheader);
-                            break;
-                        case rfbEncodingContinuousUpdates:
-                            encodingResult = _handle_server_continuous_updates_message(rectheader);
-                            break;
-                        case rfbEncodingLastRect:
-                            DEBUG_VNC("[rfbEncodingLastRect] LAST\n");
-                            encodingResult = true;
-                            break;
-#ifdef SET_DESKTOP_SIZE
-                        case rfbEncodingNewFBSize:
-                            DEBUG_VNC("[rfbEncodingNewFBSize]\n");
-                            encodingResult = true;
-                            break;
-#endif
-                        default:
-                            DEBUG_VNC("Unknown encoding 0x%08X %d\n", rectheader.encoding, rectheader.encoding);
-                            break;
-                    }
-
-#ifdef FPS_BENCHMARK
-                    unsigned long encodingTime = micros() - encodingStart;
-                    double fps = ((double) (1 * 1000 * 1000) / (double) encodingTime);
-                    DEBUG_VNC("[Benchmark][0x%08X][%d]\t us: %d \tfps: %s \tHeap: %d\n", rectheader.encoding, rectheader.encoding, encodingTime, String(fps, 2).c_str(), ESP.getFreeHeap());
-#endif
-                    //wdt_enable(0);
-                    if(!encodingResult) {
-                        DEBUG_VNC("[0x%08X][%d] encoding Failed!\n", rectheader.encoding, rectheader.encoding);
-                        disconnect();
-                        return false;
-                    } else {
-                        //DEBUG_VNC("[0x%08X] encoding ok!\n", rectheader.encoding);
-                    }
-
-                    /* Now we may discard "soft cursor locks". */
-                    //SoftCursorUnlockScreen();
+                if(updatesPending) {
+                    updatesPending--;
+                }
+                lastUpdateReceived = millis();
+                _rate_frame_start(messageStartUs);
+                VNC_TRACE_EVENT(VNC_TRACE_FRAME_START, 0, 0, 0, 0, msg.fu.nRects);
+                fbuRects = msg.fu.nRects;
+                fbuRect = 0;
+                fbuLastRect = false;
+                fbuActive = true;
+                if(!_handle_framebuffer_update_rects()) {
+                    return false;
                 }
                 break;
             case rfbSetColourMapEntries:
@@ -1141,6 +1717,18 @@ bool arduinoVNC::rfb_handle_server_message() {
                     return false;
                 }
                 break;
+            case rfbEndOfContinuousUpdates:
+                if(!_handle_server_continuous_updates_message()) {
+                    disconnect();
+                    return false;
+                }
+                break;
+            case rfbFence:
+                if(!_handle_server_fence_message(&msg)) {
+                    disconnect();
+                    return false;
+                }
+                break;
             default:
                 DEBUG_VNC("Unknown server message. Type: %d\n", msg.type);
                 disconnect();
@@ -1152,9 +1740,162 @@ bool arduinoVNC::rfb_handle_server_message() {
 }
 
 
-bool arduinoVNC::rfb_update_mouse() {
-    rfbPointerEventMsg msg;
+/**
+ * decode the rects of the current FramebufferUpdate, after loopBudgetUs the
+ * remaining rects are decoded by the next loop(), the server data waits meanwhile
+ */
+bool arduinoVNC::_handle_framebuffer_update_rects() {
+    rfbFramebufferUpdateRectHeader rectheader = { 0 };
+    unsigned long startUs = micros();
+    uint32_t rects = 0;
+
+    /* with nRects 0xFFFF the server streams rects until LastRect */
+    while(!fbuLastRect && (fbuRects == 0xFFFF || fbuRect < fbuRects)) {
+        if(loopBudgetUs && rects && (micros() - startUs) >= loopBudgetUs) {
+            return true;
+        }
+        rects++;
+        fbuRect++;
 
+        if(!read_from_rfb_server(sock, (char*) &rectheader, sz_rfbFramebufferUpdateRectHeader)) {
+            disconnect();
+            return false;
+        }
+        rectheader.r.x = Swap16IfLE(rectheader.r.x);
+        rectheader.r.y = Swap16IfLE(rectheader.r.y);
+        rectheader.r.w = Swap16IfLE(rectheader.r.w);
+        rectheader.r.h = Swap16IfLE(rectheader.r.h);
+        rectheader.encoding = Swap32IfLE(rectheader.encoding);
+#ifdef VNC_RICH_CURSOR
+        SoftCursorLockArea(rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+#endif
+
+        VNC_TRACE_EVENT(VNC_TRACE_RECT_START, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, rectheader.encoding);
+        unsigned long rectStart = micros();
+        uint32_t rectBytes = frameBytes;
+        uint32_t rectNetworkUs = frameNetworkUs;
+        uint32_t rectDisplayUs = frameDisplayUs;
+        bool encodingResult = false;
+        switch(rectheader.encoding) {
+            case rfbEncodingRaw:
+                encodingResult = _handle_raw_encoded_message(rectheader);
+                break;
+            case rfbEncodingCopyRect:
+                encodingResult = _handle_copyrect_encoded_message(rectheader);
+                break;
+#ifdef VNC_RRE
+            case rfbEncodingRRE:
+                encodingResult = _handle_rre_encoded_message(rectheader);
+                break;
+#endif
+#ifdef VNC_CORRE
+            case rfbEncodingCoRRE:
+                encodingResult = _handle_corre_encoded_message(rectheader);
+                break;
+#endif
+#ifdef VNC_HEXTILE
+            case rfbEncodingHextile:
+                encodingResult = _handle_hextile_encoded_message(rectheader);
+                break;
+#endif
+#ifdef VNC_ZRLE
+            case rfbEncodingZRLE:
+                encodingResult = _handle_zrle_encoded_message(rectheader);
+                break;
+#endif
+#ifdef VNC_TIGHT
+                case rfbEncodingTight:
+                encodingResult =_handle_tight_encoded_message(rectheader);
+                break;
+#endif
+#ifdef VNC_ZLIB
+                case rfbEncodingZlib:
+                encodingResult =_handle_zlib_encoded_message(rectheader);
+                break;
+#endif
+#ifdef VNC_RICH_CURSOR
+                case rfbEncodingXCursor:
+                case rfbEncodingRichCursor:
+                encodingResult = _handle_richcursor_message(rectheader);
+                break;
+#endif
+            case rfbEncodingPointerPos:
+                encodingResult = _handle_cursor_pos_message(rectheader);
+                break;
+            case rfbEncodingLastRect:
+                DEBUG_VNC("[rfbEncodingLastRect] LAST\n");
+                fbuLastRect = true;
+                encodingResult = true;
+                break;
+            case rfbEncodingNewFBSize:
+                DEBUG_VNC("[rfbEncodingNewFBSize] w: %d h: %d\n", rectheader.r.w, rectheader.r.h);
+                _desktop_resize(rectheader.r.w, rectheader.r.h);
+                encodingResult = true;
+                break;
+            case rfbEncodingExtendedDesktopSize:
+                encodingResult = _handle_ext_desktop_size_message(rectheader);
+                break;
+            default:
+                DEBUG_VNC("Unknown encoding 0x%08X %d\n", rectheader.encoding, rectheader.encoding);
+                break;
+        }
+        _clip_fill_flush();
+
+        if(encodingResult) {
+            vnc_stats_counter_t rect;
+            uint32_t rectUs = micros() - rectStart;
+            rect.rects = 1;
+            rect.pixels = (uint32_t) rectheader.r.w * rectheader.r.h;
+            rect.bytes = frameBytes - rectBytes;
+            rect.networkUs = frameNetworkUs - rectNetworkUs;
+            rect.displayUs = frameDisplayUs - rectDisplayUs;
+            rect.decodeUs = (rectUs > (rect.networkUs + rect.displayUs)) ? (rectUs - rect.networkUs - rect.displayUs) : 0;
+            VNC_TRACE_EVENT(VNC_TRACE_RECT_END, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, rect.bytes);
+            if(statsEnabled) {
+                _stats_rect(rectheader.encoding, &rect);
+            }
+#ifdef VNC_ADAPTIVE_ENCODING
+            _encoding_sample(rectheader.encoding, &rect);
+#endif
+        }
+        //wdt_enable(0);
+        if(!encodingResult) {
+            DEBUG_VNC("[0x%08X][%d] encoding Failed!\n", rectheader.encoding, rectheader.encoding);
+            disconnect();
+            return false;
+        } else {
+            //DEBUG_VNC("[0x%08X] encoding ok!\n", rectheader.encoding);
+        }
+    }
+
+    fbuActive = false;
+#ifdef VNC_RICH_CURSOR
+    /* Now we may discard "soft cursor locks". */
+    SoftCursorShow();
+#endif
+    _rate_frame_done();
+    VNC_TRACE_EVENT(VNC_TRACE_FRAME_END, 0, 0, 0, 0, 0);
+    if(cuEnabled || cuPaused) {
+        if(!rfb_continuous_updates_frame_done()) {
+            disconnect();
+            return false;
+        }
+    } else if(fenceSupported && !fencePending) {
+        // the answer to an incremental request waits for changes, the Fence measures the network
+        if(!rfb_send_fence_request()) {
+            disconnect();
+            return false;
+        }
+    }
+    return true;
+}
+
+
+/**
+ * queue the pointer state, motion with the same buttons replaces the queued position,
+ * a button change goes into the input queue as it is so every transition reaches the server
+ */
+bool arduinoVNC::rfb_update_mouse() {
     if(mousestate.x < 0)
         mousestate.x = 0;
     if(mousestate.y < 0)
@@ -1165,31 +1906,96 @@ bool arduinoVNC::rfb_update_mouse() {
     if(mousestate.y > opt.client.height)
         mousestate.y = opt.client.height;
 
-    msg.type = rfbPointerEvent;
-    msg.buttonMask = mousestate.buttonmask;
-
-    /* scale to server resolution */
-    msg.x = mousestate.x; //rint(mousestate.x * opt.h_ratio);
-    msg.y = mousestate.y; //rint(mousestate.y * opt.v_ratio);
-
 #ifdef VNC_RICH_CURSOR
-    SoftCursorMove(msg.x, msg.y);
+    SoftCursorMove(mousestate.x, mousestate.y);
 #endif
 
-    msg.x = Swap16IfLE(msg.x);
-    msg.y = Swap16IfLE(msg.y);
+    bool transition = (pointerSentButtons != mousestate.buttonmask);
+    if(pointerQueued && transition) {
+        if(!_input_commit_pointer()) {
+            return false;
+        }
+    }
+
+    if(!pointerQueued && pointerSent && pointerSentX == mousestate.x && pointerSentY == mousestate.y && pointerSentButtons == mousestate.buttonmask) {
+        // nothing new for the server
+        return true;
+    }
+
+    /* scale to server resolution */
+    pointerX = mousestate.x; //rint(mousestate.x * opt.h_ratio);
+    pointerY = mousestate.y; //rint(mousestate.y * opt.v_ratio);
+    pointerButtons = mousestate.buttonmask;
+    pointerQueued = true;
 
-    return (write_exact(sock, (char*) &msg, sz_rfbPointerEventMsg));
+    if(statsEnabled) {
+        _stats_input();
+    }
+    VNC_TRACE_EVENT(VNC_TRACE_POINTER, mousestate.x, mousestate.y, 0, 0, mousestate.buttonmask);
+
+    if(transition) {
+        return _input_commit_pointer();
+    }
+    return true;
 }
 
 bool arduinoVNC::rfb_send_key_event(int key, int down_flag) {
     rfbKeyEventMsg ke;
 
+    if(handshakeState != VNC_HANDSHAKE_DONE) {
+        return false;
+    }
+
     ke.type = rfbKeyEvent;
     ke.down = down_flag;
+    ke.pad = 0;
     ke.key = Swap32IfLE(key);
 
-    return (write_exact(sock, (char*) &ke, sz_rfbKeyEventMsg));
+    // keep the order to the pointer events
+    if(!_input_commit_pointer()) {
+        return false;
+    }
+
+    if(clipboardText) {
+        // a held key down keeps room for its release,
+        // a release may overtake pointer motion that waits for the text
+        if((down_flag && pointerQueued) || !_clipboard_hold_room(sz_rfbKeyEventMsg * (down_flag ? 2 : 1), !down_flag)) {
+            DEBUG_VNC("[rfb_send_key_event] clipboard hold full, key 0x%X dropped\n", key);
+            return true;
+        }
+        if(down_flag) {
+            clipboardHoldReserve += sz_rfbKeyEventMsg;
+        } else if(clipboardHoldReserve) {
+            clipboardHoldReserve -= sz_rfbKeyEventMsg;
+        }
+    }
+    return write_exact(sock, (char *) &ke, sz_rfbKeyEventMsg);
+}
+
+/**
+ * write the queued pointer state, it is no longer replaced by motion
+ */
+bool arduinoVNC::_input_commit_pointer(void) {
+    if(!pointerQueued || handshakeState != VNC_HANDSHAKE_DONE) {
+        // during the handshake the pointer waits for the session
+        return true;
+    }
+    if(!_clipboard_hold_room(sz_rfbPointerEventMsg)) {
+        // stays queued, the state is sent after the clipboard text
+        return true;
+    }
+    rfbPointerEventMsg msg;
+    msg.type = rfbPointerEvent;
+    msg.buttonMask = pointerButtons;
+    msg.x = Swap16IfLE(pointerX);
+    msg.y = Swap16IfLE(pointerY);
+
+    pointerQueued = false;
+    pointerSent = true;
+    pointerSentX = pointerX;
+    pointerSentY = pointerY;
+    pointerSentButtons = pointerButtons;
+    return write_exact(sock, (char *) &msg, sz_rfbPointerEventMsg);
 }
 
 //#############################################################################################
@@ -1200,32 +2006,53 @@ bool arduinoVNC::_handle_server_cut_text_message(rfbServerToClientMsg * msg) {
 
     DEBUG_VNC("[_handle_server_cut_text_message] work...\n");
 
-    CARD32 size;
-    char *buf;
-
     if(!read_from_rfb_server(sock, ((char*) &msg->sct) + 1, sz_rfbServerCutTextMsg - 1)) {
         return false;
     }
-    size = Swap32IfLE(msg->sct.length);
+    cutTextLength = Swap32IfLE(msg->sct.length);
+    cutTextOffset = 0;
 
-    DEBUG_VNC("[_handle_server_cut_text_message] size: %d\n", size);
+    DEBUG_VNC("[_handle_server_cut_text_message] size: %d\n", cutTextLength);
 
-    buf = (char *) malloc((sizeof(char) * size) + 1);
-    if(!buf) {
-        DEBUG_VNC("[_handle_server_cut_text_message] no memory!\n");
-        return false;
+    if(!cutTextLength && cutTextCb) {
+        cutTextCb(cutTextArg, "", 0, 0, 0);
     }
+    return _handle_server_cut_text_data();
+}
 
-    if(!read_from_rfb_server(sock, buf, size)) {
-        freeSec(buf);
-        return false;
+/**
+ * read up to VNC_CUTTEXT_LOOP bytes of the text that already arrived in chunks,
+ * the rest is read by the next loop() so a large clipboard never blocks the session and needs no memory
+ */
+bool arduinoVNC::_handle_server_cut_text_data(void) {
+    char chunk[VNC_CUTTEXT_CHUNK + 1];
+    uint32_t length = min(cutTextLength, cutTextMax);
+    uint32_t end = min(cutTextLength, cutTextOffset + (uint32_t) VNC_CUTTEXT_LOOP);
+
+    while(cutTextOffset < end) {
+        size_t available = TCPclient.available();
+        if(!available) {
+            return true;
+        }
+        size_t len = min((size_t) (end - cutTextOffset), min(available, (size_t) VNC_CUTTEXT_CHUNK));
+        if(!read_from_rfb_server(sock, chunk, len)) {
+            return false;
+        }
+        if(cutTextCb && cutTextOffset < length) {
+            size_t use = min(len, (size_t) (length - cutTextOffset));
+            chunk[use] = 0;
+            cutTextCb(cutTextArg, chunk, use, cutTextOffset, length);
+        }
+        cutTextOffset += len;
     }
 
-    buf[size] = 0;
-
-    DEBUG_VNC("[_handle_server_cut_text_message] msg: %s\n", buf);
+    if(cutTextOffset < cutTextLength) {
+        return true;
+    }
 
-    freeSec(buf);
+    if(cutTextLength > length) {
+        DEBUG_VNC("[_handle_server_cut_text_data] dropped %d bytes\n", cutTextLength - length);
+    }
     return true;
 }
 
@@ -1238,12 +2065,18 @@ bool arduinoVNC::_handle_raw_encoded_message(rfbFramebufferUpdateRectHeader rect
     uint32_t maxSize = (ESP.getFreeHeap() / 4); // max use 20% of the free HEAP
     char *buf = NULL;
 #else
-    static uint32_t maxSize = VNC_RAW_BUFFER;
-    static char *buf = (char *) malloc(maxSize);
+    uint32_t maxSize = VNC_RAW_BUFFER;
+    char *buf = pool->getRaw();
 #endif
 
     DEBUG_VNC_RAW("[_handle_raw_encoded_message] x: %d y: %d w: %d h: %d bytes: %d!\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, msgSize);
 
+    clip_t clip;
+    _clip_rect(&clip, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+    if(clip.allHidden) {
+        return skip_from_rfb_server(sock, msgSize);
+    }
+
     if(msgSize > maxSize) {
         msgPixel = (maxSize / (opt.client.bpp / 8));
         msgSize = (msgPixel * (opt.client.bpp / 8));
@@ -1252,9 +2085,9 @@ bool arduinoVNC::_handle_raw_encoded_message(rfbFramebufferUpdateRectHeader rect
 
     DEBUG_VNC_RAW("[_handle_raw_encoded_message] msgPixel: %d msgSize: %d\n", msgPixel, msgSize);
 
-    display->area_update_start(rectheader.r.x - opt.v_offset, rectheader.r.y - opt.h_offset, rectheader.r.w, rectheader.r.h);
+    _clip_area_start(&clip);
 #ifdef VNC_SAVE_MEMORY
-    buf = (char *) malloc(msgSize);
+    buf = (char *) vnc_malloc(VNC_MEM_RAW, msgSize);
 #endif
     if(!buf) {
         DEBUG_VNC("[_handle_raw_encoded_message] TO LESS MEMORY TO HANDLE DATA!");
@@ -1276,13 +2109,13 @@ bool arduinoVNC::_handle_raw_encoded_message(rfbFramebufferUpdateRectHeader rect
             return false;
         }
 
-        display->area_update_data(buf, msgPixel);
+        _clip_area_data(&clip, buf, msgPixel);
 
         msgPixelTotal -= msgPixel;
         delay(0);
     }
 
-    display->area_update_end();
+    _clip_area_end(&clip);
 
 #ifdef VNC_SAVE_MEMORY
     freeSec(buf);
@@ -1292,22 +2125,48 @@ bool arduinoVNC::_handle_raw_encoded_message(rfbFramebufferUpdateRectHeader rect
     return true;
 }
 
+/**
+ * the visible part of the destination is copied on the display,
+ * if its source is not completely on the display the destination is requested again
+ */
 bool arduinoVNC::_handle_copyrect_encoded_message(rfbFramebufferUpdateRectHeader rectheader) {
-    int src_x, src_y;
+    rfbCopyRect cr;
 
-    if(!read_from_rfb_server(sock, (char*) &src_x, 2)) {
+    if(!read_from_rfb_server(sock, (char*) &cr, sz_rfbCopyRect)) {
         return false;
     }
+    cr.srcX = Swap16IfLE(cr.srcX);
+    cr.srcY = Swap16IfLE(cr.srcY);
 
-    if(!read_from_rfb_server(sock, (char*) &src_y, 2)) {
-        return false;
+    clip_t dst;
+    _clip_rect(&dst, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+    if(dst.allHidden) {
+        return true;
+    }
+
+    // source of the visible part in display coordinates
+    int32_t src_x = ((int32_t) cr.srcX - opt.v_offset) + ((int32_t) dst.vx - dst.x);
+    int32_t src_y = ((int32_t) cr.srcY - opt.h_offset) + ((int32_t) dst.vy - dst.y);
+    if(src_x < 0 || src_y < 0 || (src_x + dst.vw) > opt.client.width || (src_y + dst.vh) > opt.client.height) {
+        DEBUG_VNC("[_handle_copyrect_encoded_message] source not on the display, request %dx%d\n", rectheader.r.w, rectheader.r.h);
+        return rfb_send_update_request(0, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
     }
 
+#ifdef VNC_RICH_CURSOR
     /* If RichCursor encoding is used, we should extend our
      "cursor lock area" (previously set to destination
      rectangle) to the source rectangle as well. */
-    //SoftCursorLockArea(src_x, src_y, rectheader.r.w, rectheader.r.h);
-    display->copy_rect(Swap16IfLE(src_x), Swap16IfLE(src_y), rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+    SoftCursorLockArea(cr.srcX, cr.srcY, rectheader.r.w, rectheader.r.h);
+#endif
+    _clip_fill_flush();
+    unsigned long t = micros();
+    display->copy_rect(src_x, src_y, dst.vx, dst.vy, dst.vw, dst.vh);
+    t = micros() - t;
+    frameDisplayUs += t;
+    VNC_TRACE_EVENT(VNC_TRACE_DISPLAY, dst.vx, dst.vy, dst.vw, dst.vh, t);
+    if(statsEnabled) {
+        _stats_pixels(dst.vx, dst.vy, dst.vw, dst.vh);
+    }
     return true;
 }
 
@@ -1322,12 +2181,18 @@ bool arduinoVNC::_handle_rre_encoded_message(rfbFramebufferUpdateRectHeader rect
     }
     header.nSubrects = Swap32IfLE(header.nSubrects);
 
+    clip_t clip;
+    _clip_rect(&clip, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+    if(clip.allHidden) {
+        return skip_from_rfb_server(sock, sizeof(colour) + (header.nSubrects * (sizeof(colour) + sizeof(rect))));
+    }
+
     /* draw background rect */
     if(!read_from_rfb_server(sock, (char *) &colour, sizeof(colour))) {
         return false;
     }
 
-    display->draw_rect(rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, Swap16IfLE(colour));
+    _clip_draw_rect(rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, Swap16IfLE(colour));
 
     /* subrect pixel values */
     for(uint32_t i = 0; i < header.nSubrects; i++) {
@@ -1336,7 +2201,7 @@ bool arduinoVNC::_handle_rre_encoded_message(rfbFramebufferUpdateRectHeader rect
         }
         if(!read_from_rfb_server(sock, (char *) &rect, sizeof(rect)))
             return false;
-        display->draw_rect(
+        _clip_draw_rect(
         Swap16IfLE(rect[0]) + rectheader.r.x,
         Swap16IfLE(rect[1]) + rectheader.r.y, Swap16IfLE(rect[2]), Swap16IfLE(rect[3]), Swap16IfLE(colour));
     }
@@ -1356,11 +2221,17 @@ bool arduinoVNC::_handle_corre_encoded_message(rfbFramebufferUpdateRectHeader re
     }
     header.nSubrects = Swap32IfLE(header.nSubrects);
 
+    clip_t clip;
+    _clip_rect(&clip, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+    if(clip.allHidden) {
+        return skip_from_rfb_server(sock, sizeof(colour) + (header.nSubrects * (sizeof(colour) + sizeof(rect))));
+    }
+
     /* draw background rect */
     if(!read_from_rfb_server(sock, (char *) &colour, sizeof(colour))) {
         return false;
     }
-    display->draw_rect(rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, Swap16IfLE(colour));
+    _clip_draw_rect(rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h, Swap16IfLE(colour));
 
     /* subrect pixel values */
     for(uint32_t i = 0; i < header.nSubrects; i++) {
@@ -1370,7 +2241,7 @@ bool arduinoVNC::_handle_corre_encoded_message(rfbFramebufferUpdateRectHeader re
         if(!read_from_rfb_server(sock, (char *) &rect, sizeof(rect))) {
             return false;
         }
-        display->draw_rect(rect[0] + rectheader.r.x, rect[1] + rectheader.r.y, rect[2], rect[3], Swap16IfLE(colour));
+        _clip_draw_rect(rect[0] + rectheader.r.x, rect[1] + rectheader.r.y, rect[2], rect[3], Swap16IfLE(colour));
     }
     return true;
 }
@@ -1391,11 +2262,21 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
 
     DEBUG_VNC_HEXTILE("[_handle_hextile_encoded_message] x: %d y: %d w: %d h: %d!\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
 
+    clip_t clip;
+    _clip_rect(&clip, rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+    if(clip.allHidden) {
+        return _skip_hextile_encoded_message(rectheader);
+    }
+
     //alloc max nedded size
 #ifdef VNC_SAVE_MEMORY
-    char * buf = (char *) malloc(255 * sizeof(HextileSubrectsColoured_t));
+    char * buf = (char *) vnc_malloc(VNC_MEM_HEXTILE, 255 * sizeof(HextileSubrectsColoured_t));
 #else
-    static char * buf = (char *) malloc(255 * sizeof(HextileSubrectsColoured_t));
+    char * buf = pool->getHextile();
+#ifdef VNC_FRAMEBUFFER
+    // tile buffers rotate, the display may still send the previous tile
+    vnc_area_completion_t * tileDone = NULL;
+#endif
 #endif
     if(!buf) {
         DEBUG_VNC("[_handle_hextile_encoded_message] too less memory!\n");
@@ -1430,6 +2311,9 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
             rect_xW = rect_x + (j * 16);
             rect_yW = rect_y + (i * 16);
 
+            clip_t tile;
+            _clip_rect(&tile, rect_xW, rect_yW, tile_w, tile_h);
+
             /* first, check if the raw bit is set */
             if(subrect_encoding & rfbHextileRaw) {
                 rfbFramebufferUpdateRectHeader rawUpdate;
@@ -1473,19 +2357,26 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
                 //DEBUG_VNC_HEXTILE("[_handle_hextile_encoded_message] subrect: x: %d y: %d w: %d h: %d\n", rect_xW, rect_yW, tile_w, tile_h);
 
 #ifdef VNC_FRAMEBUFFER
-                if(!fb.begin(tile_w, tile_h)) {
-                    DEBUG_VNC("[_handle_hextile_encoded_message] too less memory!\n");
+                if(!tile.allHidden) {
+#ifndef VNC_SAVE_MEMORY
+                    uint8_t * tileBuffer = pool->getTile(&tileDone);
+                    fb.setBuffer(tileBuffer, tileBuffer ? (16 * 16 * 2) : 0);
+                    _area_wait(tileDone);
+#endif
+                    if(!fb.begin(tile_w, tile_h)) {
+                        DEBUG_VNC("[_handle_hextile_encoded_message] too less memory!\n");
 #ifdef VNC_SAVE_MEMORY
-                freeSec(buf);
+                        freeSec(buf);
 #endif
-                    return false;
-                }
+                        return false;
+                    }
 
-                /* fill the background */
-                fb.draw_rect(0, 0, tile_w, tile_h, bgColor);
+                    /* fill the background */
+                    fb.draw_rect(0, 0, tile_w, tile_h, bgColor);
+                }
 #else
                 /* fill the background */
-                display->draw_rect(rect_xW, rect_yW, tile_w, tile_h, Swap16IfLE(bgColor));
+                _clip_draw_rect(rect_xW, rect_yW, tile_w, tile_h, Swap16IfLE(bgColor));
 #endif
 
                 if(subrect_encoding & rfbHextileAnySubrects) {
@@ -1507,12 +2398,12 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
                             }
 
                             HextileSubrectsColoured_t * bufPC = (HextileSubrectsColoured_t *) buf;
-                            for(uint8_t n = 0; n < nr_subr; n++) {
+                            for(uint8_t n = 0; n < nr_subr && !tile.allHidden; n++) {
                                 //  DEBUG_VNC_HEXTILE("[_handle_hextile_encoded_message] Coloured nr_subr: %d bufPC: 0x%08X\n", n, bufPC);
 #ifdef VNC_FRAMEBUFFER
                                 fb.draw_rect(bufPC->x, bufPC->y, bufPC->w + 1, bufPC->h + 1, bufPC->color);
 #else
-                                display->draw_rect(rect_xW + bufPC->x, rect_yW + bufPC->y, bufPC->w+1, bufPC->h+1, Swap16IfLE(bufPC->color));
+                                _clip_draw_rect(rect_xW + bufPC->x, rect_yW + bufPC->y, bufPC->w+1, bufPC->h+1, Swap16IfLE(bufPC->color));
 #endif
                                 bufPC++;
                             }
@@ -1526,13 +2417,13 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
                             }
 
                             HextileSubrects_t * bufP = (HextileSubrects_t *) buf;
-                            for(uint8_t n = 0; n < nr_subr; n++) {
+                            for(uint8_t n = 0; n < nr_subr && !tile.allHidden; n++) {
 
                                 // DEBUG_VNC_HEXTILE("[_handle_hextile_encoded_message] nr_subr: %d bufP: 0x%08X\n", n, bufP);
 #ifdef VNC_FRAMEBUFFER
                                 fb.draw_rect(bufP->x, bufP->y, bufP->w + 1, bufP->h + 1, fgColor);
 #else
-                                display->draw_rect(rect_xW + bufP->x, rect_yW + bufP->y, bufP->w+1, bufP->h+1, Swap16IfLE(fgColor));
+                                _clip_draw_rect(rect_xW + bufP->x, rect_yW + bufP->y, bufP->w+1, bufP->h+1, Swap16IfLE(fgColor));
 #endif
                                 bufP++;
                             }
@@ -1540,7 +2431,13 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
                     }
                 }
 #ifdef VNC_FRAMEBUFFER
-                display->draw_area(rect_xW - opt.v_offset, rect_yW - opt.h_offset, tile_w, tile_h, fb.getPtr());
+                if(!tile.allHidden) {
+#ifdef VNC_SAVE_MEMORY
+                    _clip_draw_area(rect_xW, rect_yW, tile_w, tile_h, fb.getPtr());
+#else
+                    _clip_draw_area(rect_xW, rect_yW, tile_w, tile_h, fb.getPtr(), tileDone);
+#endif
+                }
 #endif
             }
             j++;
@@ -1561,6 +2458,59 @@ bool arduinoVNC::_handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader
     DEBUG_VNC_HEXTILE("[_handle_hextile_encoded_message] ------------------------ Fin ------------------------\n");
     return true;
 }
+
+/**
+ * parse the tile headers of an invisible Hextile rect and skip the payload
+ */
+bool arduinoVNC::_skip_hextile_encoded_message(rfbFramebufferUpdateRectHeader rectheader) {
+    CARD8 subrect_encoding;
+    uint8_t nr_subr;
+    size_t skip;
+
+    DEBUG_VNC_HEXTILE("[_skip_hextile_encoded_message] x: %d y: %d w: %d h: %d!\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+
+    for(uint32_t y = 0; y < rectheader.r.h; y += 16) {
+        uint32_t tile_h = min((uint32_t) 16, rectheader.r.h - y);
+        for(uint32_t x = 0; x < rectheader.r.w; x += 16) {
+            uint32_t tile_w = min((uint32_t) 16, rectheader.r.w - x);
+
+            if(!read_from_rfb_server(sock, (char*) &subrect_encoding, 1)) {
+                return false;
+            }
+
+            if(subrect_encoding & rfbHextileRaw) {
+                skip = tile_w * tile_h * (opt.client.bpp / 8);
+            } else {
+                skip = 0;
+                if(subrect_encoding & rfbHextileBackgroundSpecified) {
+                    skip += sizeof(uint16_t);
+                }
+                if(subrect_encoding & rfbHextileForegroundSpecified) {
+                    skip += sizeof(uint16_t);
+                }
+                if(subrect_encoding & rfbHextileAnySubrects) {
+                    if(skip && !skip_from_rfb_server(sock, skip)) {
+                        return false;
+                    }
+                    if(!read_from_rfb_server(sock, (char*) &nr_subr, 1)) {
+                        return false;
+                    }
+                    if(subrect_encoding & rfbHextileSubrectsColoured) {
+                        skip = nr_subr * sizeof(HextileSubrectsColoured_t);
+                    } else {
+                        skip = nr_subr * sizeof(HextileSubrects_t);
+                    }
+                }
+            }
+
+            if(skip && !skip_from_rfb_server(sock, skip)) {
+                return false;
+            }
+        }
+        delay(0);
+    }
+    return true;
+}
 #endif
 
 #ifdef VNC_ZLIB
@@ -1578,7 +2528,14 @@ bool arduinoVNC::_handle_zlib_encoded_message(rfbFramebufferUpdateRectHeader rec
 
     DEBUG_VNC_ZLIB("[_handle_zlib_encoded_message] Byte size %zu\n", remaining);
 
-    size_t processed = 0;
+    if(!_inflate_available()) {
+        DEBUG_VNC("[_handle_zlib_encoded_message] no inflate buffers!\n");
+        return false;
+    }
+
+    if(!_inflate_claim(rfbEncodingZlib)) {
+        return false;
+    }
 
     zin_next = zin;
     mz_uint32 flags = TINFL_FLAG_HAS_MORE_INPUT | TINFL_FLAG_PARSE_ZLIB_HEADER;
@@ -1590,32 +2547,11 @@ bool arduinoVNC::_handle_zlib_encoded_message(rfbFramebufferUpdateRectHeader rec
 
     bool leftOver = false;
 
-    int32_t xOffset = rectheader.r.x - opt.v_offset;
-    int32_t yOffset = rectheader.r.y - opt.h_offset;
-
-    int32_t xAvail = ((int32_t)display->getWidth())-xOffset;
-    int32_t yAvail = ((int32_t)display->getHeight())-yOffset;
-
-    bool allVisible =
-        xOffset >= 0 &&
-        yOffset >= 0 &&
-        w <= xAvail &&
-        h <= yAvail;
+    clip_t clip;
+    _clip_rect(&clip, rectheader.r.x, rectheader.r.y, w, h);
+    _clip_area_start(&clip);
 
-    bool allHidden =
-        xOffset + w < 0 ||
-        yOffset + h < 0 ||
-        xOffset >= display->getWidth() ||
-        yOffset >= display->getHeight();
-
-    display->area_update_start(
-        max((int32_t)0, xOffset),
-        max((int32_t)0, yOffset),
-        min(xAvail, (int32_t)w),
-        min(yAvail, (int32_t)h)
-        );
-
-    DEBUG_VNC_ZLIB("[_handle_zlib_encoded_message] visi: %d hidden: %d\n", allVisible, allHidden);
+    DEBUG_VNC_ZLIB("[_handle_zlib_encoded_message] visi: %d hidden: %d\n", clip.allVisible, clip.allHidden);
 
     while (remaining) {
         size_t toRead = min(remaining, (size_t)ZRLE_INPUT_BUFFER - ((zin_next - zin) + bytes_available));
@@ -1634,7 +2570,9 @@ bool arduinoVNC::_handle_zlib_encoded_message(rfbFramebufferUpdateRectHeader rec
             size_t bytes_decompressed = zout + ZRLE_OUTPUT_BUFFER - zout_next;
             size_t bytes_consumed = bytes_available;
 
+            VNC_TRACE_EVENT(VNC_TRACE_INFLATE_START, 0, 0, 0, 0, bytes_available);
             tinfl_status last_status = tinfl_decompress(&inflator, zin_next, &bytes_consumed, zout, zout_next, &bytes_decompressed, flags);
+            VNC_TRACE_EVENT(VNC_TRACE_INFLATE_END, 0, 0, 0, 0, bytes_decompressed);
             if(last_status < TINFL_STATUS_DONE) {
                 DEBUG_VNC_ZLIB("[_handle_zlib_encoded_message] decoding failed: %d\n", last_status);
                 return false;
@@ -1646,28 +2584,7 @@ bool arduinoVNC::_handle_zlib_encoded_message(rfbFramebufferUpdateRectHeader rec
                 bytes_decompressed++;
                 zout_next--;
             }
-            if(allVisible) {
-                display->area_update_data((char *)zout_next, bytes_decompressed / 2);
-                processed += bytes_decompressed / 2;
-            } else if (allHidden){
-                processed += bytes_decompressed / 2;
-            } else {
-                uint32_t n = 0;
-                while(n+1 < bytes_decompressed) {
-                    int32_t cX = (processed % w) + xOffset;
-                    int32_t cY = (processed / w) + yOffset;
-                    if(cX >= 0 && cY >= 0 && cX < display->getWidth() && cY < display->getHeight()) {
-                        // This could be further optimized to consider line wrapping, but doesn't seem worth the effort
-                        uint32_t printable = min(display->getWidth() - cX, (bytes_decompressed-n) / 2);
-                        display->area_update_data((char *)zout_next+n, printable);
-                        processed += printable;
-                        n += printable*2;
-                    } else {
-                        processed++;
-                        n += 2;
-                    }
-                }
-            }
+            _clip_area_data(&clip, (char *)zout_next, bytes_decompressed / 2);
             zout_next += bytes_decompressed;
             // Check if we have a left over byte for next run
             leftOver = bytes_decompressed % 2;
@@ -1678,9 +2595,9 @@ bool arduinoVNC::_handle_zlib_encoded_message(rfbFramebufferUpdateRectHeader rec
         }
     }
 
-    display->area_update_end();
+    _clip_area_end(&clip);
 
-    DEBUG_VNC_ZLIB("[_handle_zlib_encoded_message] done (%zu of %zu)\n", processed, w*h);
+    DEBUG_VNC_ZLIB("[_handle_zlib_encoded_message] done (%zu of %zu)\n", clip.pixel, w*h);
 
     return true;
 }
@@ -1703,11 +2620,31 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
 
     DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] len: %zu\n", len);
 
+    if(!_inflate_available()) {
+        DEBUG_VNC("[_handle_zrle_encoded_message] no inflate buffers!\n");
+        return false;
+    }
+
+    if(!_inflate_claim(rfbEncodingZRLE)) {
+        return false;
+    }
+
     msg_bytes_remain = len;
     zin_next = zin;
     bytes_available = 0;
     zout_read = zout_next;
 
+    clip_t clip;
+    _clip_rect(&clip, x, y, w, h);
+    if(clip.allHidden) {
+        DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] hidden, only inflate\n");
+        return skip_from_z();
+    }
+
+    // tile buffers rotate, the display may still send the previous tile
+    uint16_t * framebuffer = NULL;
+    vnc_area_completion_t * tileDone = NULL;
+
     uint16_t rect_x, rect_y, rect_w, rect_h, i = 0, j = 0;
     uint16_t rect_xW, rect_yW;
 
@@ -1750,12 +2687,24 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
         rect_xW = rect_x + j;
         rect_yW = rect_y + i;
 
+        clip_t tile;
+        _clip_rect(&tile, rect_xW, rect_yW, tile_w, tile_h);
+
         read_from_z(&subrect_encoding, 1);
 
+        if (!tile.allHidden && subrect_encoding != rfbTrleSolid) {
+            framebuffer = pool->getZrleTile(&tileDone);
+            if(!framebuffer) {
+                DEBUG_VNC("[_handle_zrle_encoded_message] too less memory!\n");
+                return false;
+            }
+            _area_wait(tileDone);
+        }
+
         if (subrect_encoding == rfbTrleRaw) {
             DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d RAW x: %d y: %d w: %d h: %d\n", subrect_encoding, rect_xW, rect_yW, tile_w, tile_h);
-            read_from_z((uint8_t *)framebuffer, tile_size * 2);
-            display->draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer);
+            read_from_z(tile.allHidden ? NULL : (uint8_t *)framebuffer, tile_size * 2);
+            _clip_draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer, tileDone);
         } else {
             paletteSize = subrect_encoding & 127;
 
@@ -1763,11 +2712,14 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
  
             if (subrect_encoding == rfbTrleSolid) {
                 DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d SOLID x: %d y: %d w: %d h: %d c: %d\n", subrect_encoding, rect_xW, rect_yW, tile_w, tile_h, palette[0]);
-                display->draw_rect(rect_xW, rect_yW, tile_w, tile_h, Swap16IfLE(palette[0]));
+                _clip_draw_rect(rect_xW, rect_yW, tile_w, tile_h, Swap16IfLE(palette[0]));
             } else if (subrect_encoding <= rfbTrleReusePackedPalette) {
                 p = framebuffer;
                 uint8_t data = 0;
-                if (paletteSize == 2) { // 1-bit
+                if (tile.allHidden) {
+                    uint8_t bits = (paletteSize == 2) ? 1 : (paletteSize <= 4) ? 2 : (paletteSize <= 16) ? 4 : 8;
+                    read_from_z(NULL, ((tile_w * bits + 7) / 8) * tile_h);
+                } else if (paletteSize == 2) { // 1-bit
                     DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d 1-bit, x: %d y: %d w: %d h: %d\n", subrect_encoding, rect_xW, rect_yW, tile_w, tile_h);
 
                     for (int hidx = 0; hidx < tile_h; ++hidx) {
@@ -1815,7 +2767,7 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
                     }
                 }
 
-                display->draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer);
+                _clip_draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer, tileDone);
             } else if (subrect_encoding == rfbTrlePlainRLE) {
                 DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d Plain RLE x: %d y: %d w: %d h: %d\n", subrect_encoding, rect_xW, rect_yW, tile_w, tile_h);
                 p = framebuffer;
@@ -1833,14 +2785,14 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
                     runLengthCount += runLength;
                     if (runLengthCount > tile_size) {
                         DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d Plain RLE runLengthCount(%d) > tile_size(%d)\n", subrect_encoding, runLengthCount, tile_size);
-                    } else {
+                    } else if (!tile.allHidden) {
                         while (runLength--) {
                             *p++ = color;
                         }
                     }
                 }
 
-                display->draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer);
+                _clip_draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer, tileDone);
             } else { // Palette RLE
                 DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d Palette RLE x: %d y: %d w: %d h: %d\n", subrect_encoding, rect_xW, rect_yW, tile_w, tile_h);
                 p = framebuffer;
@@ -1863,14 +2815,14 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
                     // DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] Palette RLE idx: %d, runLength: %d, runLengthCount: %d.\n", idx, runLength, runLengthCount);
                     if (runLengthCount > tile_size) {
                         DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] %d Palette RLE runLengthCount(%d) > tile_size(%d)\n", subrect_encoding, runLengthCount, tile_size);
-                    } else {
+                    } else if (!tile.allHidden) {
                         while (runLength--) {
                             *p++ = color;
                         }
                     }
                 }
 
-                display->draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer);
+                _clip_draw_area(rect_xW, rect_yW, tile_w, tile_h, (uint8_t *)framebuffer, tileDone);
             }
         }
 
@@ -1894,10 +2846,9 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
 
     // We need to consume the remaining data to make sure the TCP buffer is 
     // at correct position and tinfl_decompress is in the right state
-    while(msg_bytes_remain > 0) {
-        DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] reading left-over bytes from message: %d\n", msg_bytes_remain);
-        uint8_t skipped;
-        read_from_z(&skipped, 1);
+    DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] left-over bytes from message: %d\n", msg_bytes_remain + bytes_available);
+    if(!skip_from_z()) {
+        return false;
     }
     DEBUG_VNC_ZRLE("[_handle_zrle_encoded_message] ------------------------ Fin ------------------------\n");
     return true;
@@ -1906,132 +2857,1344 @@ bool arduinoVNC::_handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rec
 
 bool arduinoVNC::_handle_cursor_pos_message(rfbFramebufferUpdateRectHeader rectheader) {
     DEBUG_VNC_RICH_CURSOR("[HandleCursorPos] x: %d y: %d w: %d h: %d\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+#ifdef VNC_RICH_CURSOR
+    SoftCursorMove(rectheader.r.x, rectheader.r.y);
+#endif
+    return true;
+}
+
+bool arduinoVNC::_handle_ext_desktop_size_message(rfbFramebufferUpdateRectHeader rectheader) {
+    rfbExtDesktopSizeMsg eds;
+    rfbExtDesktopScreen screen;
+
+    DEBUG_VNC("[HandleExtDesktopSize] reason: %d status: %d w: %d h: %d\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+
+    if(!read_from_rfb_server(sock, (char *) &eds, sz_rfbExtDesktopSizeMsg)) {
+        return false;
+    }
+    for(uint8_t i = 0; i < eds.numberOfScreens; i++) {
+        if(!read_from_rfb_server(sock, (char *) &screen, sz_rfbExtDesktopScreen)) {
+            return false;
+        }
+        if(i == 0) {
+            desktopScreenId = Swap32IfLE(screen.id);
+        }
+    }
+
+    if(rectheader.r.y != rfbEDSResultSuccess) {
+        // our SetDesktopSize was refused, keep the current size and do not ask again
+        DEBUG_VNC("[HandleExtDesktopSize] SetDesktopSize failed: %d\n", rectheader.r.y);
+        return true;
+    }
+
+    _desktop_resize(rectheader.r.w, rectheader.r.h);
+
+#ifdef SET_DESKTOP_SIZE
+    if(!desktopRequested && (desktopWidth != opt.client.width || desktopHeight != opt.client.height)) {
+        return rfb_set_desktop_size();
+    }
+#endif
     return true;
 }
 
+/**
+ * center a desktop smaller than the display with a negative offset and keep
+ * a panned window inside the desktop, x uses v_offset and y h_offset
+ */
+void arduinoVNC::_desktop_offsets(void) {
+    if(desktopWidth < opt.client.width) {
+        opt.v_offset = -((opt.client.width - desktopWidth) / 2);
+    } else {
+        opt.v_offset = constrain(opt.v_offset, 0, desktopWidth - opt.server.width);
+    }
+    if(desktopHeight < opt.client.height) {
+        opt.h_offset = -((opt.client.height - desktopHeight) / 2);
+    } else {
+        opt.h_offset = constrain(opt.h_offset, 0, desktopHeight - opt.server.height);
+    }
+}
+
+/**
+ * the framebuffer of the server changed size, the decoder buffers are per tile
+ * and do not depend on it, only the visible window and the screen are updated
+ */
+void arduinoVNC::_desktop_resize(uint16_t w, uint16_t h) {
+    if(w == desktopWidth && h == desktopHeight) {
+        return;
+    }
+    DEBUG_VNC("[_desktop_resize] %dx%d -> %dx%d\n", desktopWidth, desktopHeight, w, h);
+    desktopWidth = w;
+    desktopHeight = h;
+
+    // never be bigger then the client!
+    opt.server.width = min(opt.client.width, (int) w);
+    opt.server.height = min(opt.client.height, (int) h);
+    _desktop_offsets();
+
+    // the old picture is invalid, the server sends the new one
+    _clip_fill_flush();
+    display->draw_rect(0, 0, opt.client.width, opt.client.height, 0);
+#ifdef VNC_RICH_CURSOR
+    cursorShown = false;
+#endif
+    if(cuEnabled) {
+        rfb_set_continuous_updates(true);
+    }
+    rfb_send_update_request(0);
+}
+
 #ifdef VNC_RICH_CURSOR
+/**
+ * RichCursor: pixels in client format + mask
+ * XCursor: foreground and background RGB + bitmap + mask
+ */
 bool arduinoVNC::_handle_richcursor_message(rfbFramebufferUpdateRectHeader rectheader) {
-//todo handle Cursor
     DEBUG_VNC_RICH_CURSOR("[HandleRichCursor] x: %d y: %d w: %d h: %d\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
 
     CARD16 width = rectheader.r.w;
     CARD16 height = rectheader.r.h;
 
-    size_t bytesPerRow, bytesMaskData;
-
-    bytesPerRow = (width + 7) / 8;
-    bytesMaskData = bytesPerRow * height;
+    size_t bytesMaskData = ((width + 7) / 8) * height;
 
-//FreeCursors(True);
+    // restore the screen with the old shape
+    SoftCursorHide();
+    cursorW = cursorH = 0;
 
     if(width * height == 0) {
         return true;
     }
 
-    /* Read cursor pixel data. */
-    if(richCursorData) {
-        freeSec(richCursorData);
-    }
-    richCursorData = (uint8_t *) malloc(width * height * (opt.client.bpp / 8));
-    if(richCursorData == NULL)
-    return false;
-
-    if(!read_from_rfb_server(sock, (char *) richCursorData, width * height * (opt.client.bpp / 8))) {
-        freeSec(richCursorData);
-        return false;
+#ifdef VNC_ARENA
+    if(width > VNC_CURSOR_MAX || height > VNC_CURSOR_MAX) {
+        DEBUG_VNC("[HandleRichCursor] shape larger then VNC_CURSOR_MAX, not drawn\n");
+        if(rectheader.encoding == rfbEncodingXCursor) {
+            return skip_from_rfb_server(sock, 6 + (bytesMaskData * 2));
+        }
+        return skip_from_rfb_server(sock, (width * height * (opt.client.bpp / 8)) + bytesMaskData);
     }
+#endif
 
-    /* Read and decode mask data. */
-    uint8_t * buf = (uint8_t *) malloc(bytesMaskData);
-    if(buf == NULL) {
-        freeSec(richCursorData);
+    if(!SoftCursorAlloc(width, height)) {
+        DEBUG_VNC("[HandleRichCursor] too less memory!\n");
         return false;
     }
 
-    if(!read_from_rfb_server(sock, (char *)buf, bytesMaskData)) {
-        freeSec(richCursorData);
-        freeSec(buf);
-        return false;
-    }
+    if(rectheader.encoding == rfbEncodingXCursor) {
+        uint8_t colors[6];
+        uint8_t fg[4];
+        uint8_t bg[4];
+        if(!read_from_rfb_server(sock, (char *) colors, sizeof(colors))) {
+            return false;
+        }
+        SoftCursorColor(&colors[0], fg);
+        SoftCursorColor(&colors[3], bg);
 
-    if(richCursorMask) {
-        freeSec(richCursorMask);
-    }
-    richCursorMask = (uint8_t *) malloc(width * height);
-    if(richCursorMask == NULL) {
-        freeSec(richCursorData);
-        freeSec(buf);
-        return false;
-    }
-    int32_t x, y, b;
-    uint8_t * ptr = richCursorMask;
-    for(y = 0; y < height; y++) {
-        for(x = 0; x < width / 8; x++) {
-            for(b = 7; b >= 0; b--) {
-                *ptr++ = buf[y * bytesPerRow + x] >> b & 1;
+        // the bitmap is only needed while the sprite is built, cursorImage is large enough
+        uint8_t * bitmap = cursorImage;
+        if(!read_from_rfb_server(sock, (char *) bitmap, bytesMaskData)) {
+            return false;
+        }
+        uint8_t * p = cursorPixels;
+        for(uint16_t y = 0; y < height; y++) {
+            uint8_t * row = bitmap + (y * ((width + 7) / 8));
+            for(uint16_t x = 0; x < width; x++) {
+                uint8_t * color = (row[x / 8] & (0x80 >> (x % 8))) ? fg : bg;
+                memcpy(p, color, cursorBytesPerPixel);
+                p += cursorBytesPerPixel;
             }
         }
-        for(b = 7; b > 7 - width % 8; b--) {
-            *ptr++ = buf[y * bytesPerRow + x] >> b & 1;
+    } else {
+        if(!read_from_rfb_server(sock, (char *) cursorPixels, width * height * cursorBytesPerPixel)) {
+            return false;
         }
     }
 
-    free(buf);
+    if(!read_from_rfb_server(sock, (char *) cursorMask, bytesMaskData)) {
+        return false;
+    }
 
-//todo Render Cursor
+    cursorW = width;
+    cursorH = height;
+    cursorHotX = rectheader.r.x;
+    cursorHotY = rectheader.r.y;
+    if(!SoftCursorRuns()) {
+        DEBUG_VNC("[HandleRichCursor] too less memory!\n");
+        cursorW = cursorH = 0;
+        return false;
+    }
 
+    // drawn when the FramebufferUpdate is done
     return true;
 }
 #endif
 
-bool arduinoVNC::_handle_server_continuous_updates_message(rfbFramebufferUpdateRectHeader rectheader) {
-    DEBUG_VNC("[rfbEncodingContinuousUpdates] x: %d y: %d w: %d h: %d\n", rectheader.r.x, rectheader.r.y, rectheader.r.w, rectheader.r.h);
+bool arduinoVNC::_handle_server_continuous_updates_message(void) {
+    DEBUG_VNC("[_handle_server_continuous_updates_message] EndOfContinuousUpdates\n");
+
+    if(!cuSupported) {
+        // first one is the answer to SetEncodings
+        cuSupported = true;
+        return _rfb_start_continuous_updates();
+    }
+
+    if(cuStopPending) {
+        // confirms our pause
+        cuStopPending = false;
+        return true;
+    }
+
+    // server stopped on its own, go back to update requests
+    cuEnabled = false;
     return true;
 }
 
-//#############################################################################################
-//                                      Encryption
-//#############################################################################################
+bool arduinoVNC::_handle_server_fence_message(rfbServerToClientMsg * msg) {
+    char data[64];
 
-void arduinoVNC::vncRandomBytes(unsigned char *bytes) {
-#ifdef ESP8266
-    srand(RANDOM_REG32);
-#else
-    // todo find better seed
-    srand(millis());
-#endif
-    for(int i = 0; i < CHALLENGESIZE; i++) {
-        bytes[i] = (unsigned char) (rand() & 255);
+    if(!read_from_rfb_server(sock, ((char*) &msg->f) + 1, sz_rfbFenceMsg - 1)) {
+        return false;
     }
-}
 
-void arduinoVNC::vncEncryptBytes(unsigned char *bytes, char *passwd) {
-    unsigned char key[8];
-    size_t i;
+    CARD32 flags = Swap32IfLE(msg->f.flags);
+    uint8_t length = msg->f.length;
 
-    /* key is simply password padded with nulls */
+    if(length > sizeof(data)) {
+        DEBUG_VNC("[_handle_server_fence_message] invalid length: %d\n", length);
+        return false;
+    }
 
-    for(i = 0; i < 8; i++) {
-        if(i < strlen(passwd)) {
-            key[i] = passwd[i];
-        } else {
-            key[i] = 0;
-        }
+    if(!read_from_rfb_server(sock, data, length)) {
+        return false;
     }
 
-    deskey(key, EN0);
+    if(flags & rfbFenceFlagRequest) {
+        // all messages before the Fence are processed, BlockBefore/BlockAfter are given by design
+        fenceSupported = true;
+        flags &= (rfbFenceFlagBlockBefore | rfbFenceFlagBlockAfter | rfbFenceFlagSyncNext);
+        if(!rfb_send_fence(flags, length, data)) {
+            return false;
+        }
+        return _rfb_start_continuous_updates();
+    }
 
-    for(i = 0; i < CHALLENGESIZE; i += 8) {
-        des(bytes + i, bytes + i);
+    // response to our Fence, the server has caught up with us
+    DEBUG_VNC("[_handle_server_fence_message] Fence done, %d frames in flight\n", cuFramesInFlight);
+    if(fenceSentUs) {
+        _rate_rtt_sample(micros() - fenceSentUs);
+        fenceSentUs = 0;
     }
+    fencePending = false;
+    cuFramesInFlight = 0;
+    if(cuPaused) {
+        cuPaused = false;
+        return _rfb_start_continuous_updates();
+    }
+    return true;
 }
 
 //#############################################################################################
-//                                      Cursor
+//                                      Clipping
 //#############################################################################################
 
-#ifdef VNC_RICH_CURSOR
-void arduinoVNC::SoftCursorMove(int x, int y) {
-//todo handle Cursor
+/**
+ * calculate the visible part of a server rectangle on the display
+ */
+void arduinoVNC::_clip_rect(clip_t * clip, uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    // display size is fixed after begin(), no virtual calls per primitive
+    int32_t displayW = opt.client.width;
+    int32_t displayH = opt.client.height;
+
+    clip->x = (int32_t) x - opt.v_offset;
+    clip->y = (int32_t) y - opt.h_offset;
+    clip->w = w;
+    clip->h = h;
+    clip->pixel = 0;
+
+    int32_t x1 = max(clip->x, (int32_t) 0);
+    int32_t y1 = max(clip->y, (int32_t) 0);
+    int32_t x2 = min(clip->x + (int32_t) w, displayW);
+    int32_t y2 = min(clip->y + (int32_t) h, displayH);
+
+    if(x2 <= x1 || y2 <= y1) {
+        clip->vx = clip->vy = clip->vw = clip->vh = 0;
+        clip->allHidden = true;
+        clip->allVisible = false;
+        return;
+    }
+
+    clip->vx = x1;
+    clip->vy = y1;
+    clip->vw = x2 - x1;
+    clip->vh = y2 - y1;
+    clip->allHidden = false;
+    clip->allVisible = (clip->vw == w && clip->vh == h);
+}
+
+/**
+ * fills are queued and passed to the display in batches,
+ * a RRE or Hextile rectangle has up to hundreds of tiny fills
+ */
+void arduinoVNC::_clip_draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color) {
+    clip_t clip;
+    _clip_rect(&clip, x, y, w, h);
+    if(clip.allHidden) {
+        return;
+    }
+    if(fillCount == VNC_FILL_BATCH) {
+        _clip_fill_flush();
+    }
+    vnc_fill_t * fill = &fills[fillCount++];
+    fill->x = clip.vx;
+    fill->y = clip.vy;
+    fill->w = clip.vw;
+    fill->h = clip.vh;
+    fill->color = color;
+}
+
+/**
+ * draw the queued fills, needed before any other display output
+ */
+void arduinoVNC::_clip_fill_flush(void) {
+    if(!fillCount) {
+        return;
+    }
+    unsigned long t = micros();
+    for(uint8_t i = 0; i < fillCount; i++) {
+        display->draw_rect(fills[i].x, fills[i].y, fills[i].w, fills[i].h, fills[i].color);
+    }
+    t = micros() - t;
+    frameDisplayUs += t;
+
+    uint32_t x1 = fills[0].x, y1 = fills[0].y, x2 = 0, y2 = 0;
+    for(uint8_t i = 0; i < fillCount; i++) {
+        vnc_fill_t * fill = &fills[i];
+        x1 = min(x1, (uint32_t) fill->x);
+        y1 = min(y1, (uint32_t) fill->y);
+        x2 = max(x2, (uint32_t) (fill->x + fill->w));
+        y2 = max(y2, (uint32_t) (fill->y + fill->h));
+        if(statsEnabled) {
+            _stats_pixels(fill->x, fill->y, fill->w, fill->h);
+        }
+    }
+    VNC_TRACE_EVENT(VNC_TRACE_DISPLAY, x1, y1, x2 - x1, y2 - y1, t);
+    fillCount = 0;
+}
+
+/**
+ * draw a pixel buffer, the visible part is moved to the start of data if the area is only partly visible
+ * with done the buffer is submitted and stays busy until the display releases it,
+ * wait with _area_wait before writing to it again
+ */
+void arduinoVNC::_clip_draw_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data, vnc_area_completion_t * done) {
+    _clip_fill_flush();
+
+    clip_t clip;
+    _clip_rect(&clip, x, y, w, h);
+    if(clip.allHidden) {
+        return;
+    }
+
+    if(!clip.allVisible) {
+        uint32_t bytesPerPixel = (opt.client.bpp / 8);
+        uint32_t rowSize = clip.vw * bytesPerPixel;
+        uint8_t * src = data + (((clip.vy - clip.y) * w) + (clip.vx - clip.x)) * bytesPerPixel;
+        uint8_t * dst = data;
+        for(uint32_t row = 0; row < clip.vh; row++) {
+            memmove(dst, src, rowSize);
+            dst += rowSize;
+            src += w * bytesPerPixel;
+        }
+    }
+
+    unsigned long t = micros();
+    if(done) {
+        done->busy = true;
+        done->display = display;
+        display->submit_area(clip.vx, clip.vy, clip.vw, clip.vh, data, done);
+    } else {
+        display->draw_area(clip.vx, clip.vy, clip.vw, clip.vh, data);
+    }
+    t = micros() - t;
+    frameDisplayUs += t;
+    VNC_TRACE_EVENT(VNC_TRACE_DISPLAY, clip.vx, clip.vy, clip.vw, clip.vh, t);
+    if(statsEnabled) {
+        _stats_pixels(clip.vx, clip.vy, clip.vw, clip.vh);
+    }
+}
+
+/**
+ * block until a buffer of _clip_draw_area is released by the display
+ */
+void arduinoVNC::_area_wait(vnc_area_completion_t * done) {
+    if(!done->busy) {
+        return;
+    }
+    unsigned long t = micros();
+    done->display->wait_area(done);
+    frameDisplayUs += (micros() - t);
+}
+
+void arduinoVNC::_clip_area_start(clip_t * clip) {
+    _clip_fill_flush();
+    if(clip->allHidden) {
+        return;
+    }
+    unsigned long t = micros();
+    display->area_update_start(clip->vx, clip->vy, clip->vw, clip->vh);
+    frameDisplayUs += (micros() - t);
+}
+
+/**
+ * stream the next pixels of the rectangle, only the visible spans are passed to the display
+ */
+void arduinoVNC::_clip_area_data(clip_t * clip, char * data, uint32_t pixel) {
+    unsigned long t = micros();
+    if(clip->allVisible) {
+        display->area_update_data(data, pixel);
+    } else if(!clip->allHidden) {
+        uint32_t bytesPerPixel = (opt.client.bpp / 8);
+        uint32_t col1 = clip->vx - clip->x;
+        uint32_t col2 = col1 + clip->vw;
+        uint32_t row1 = clip->vy - clip->y;
+        uint32_t row2 = row1 + clip->vh;
+        uint32_t done = 0;
+
+        while(done < pixel) {
+            uint32_t pos = clip->pixel + done;
+            uint32_t row = pos / clip->w;
+            uint32_t col = pos % clip->w;
+            uint32_t n = min(clip->w - col, pixel - done);
+
+            if(row >= row2) {
+                break;
+            }
+
+            if(row >= row1) {
+                uint32_t start = max(col, col1);
+                uint32_t end = min(col + n, col2);
+                if(start < end) {
+                    display->area_update_data(data + ((done + start - col) * bytesPerPixel), end - start);
+                }
+            }
+            done += n;
+        }
+    }
+    clip->pixel += pixel;
+    frameDisplayUs += (micros() - t);
+}
+
+void arduinoVNC::_clip_area_end(clip_t * clip) {
+    if(clip->allHidden) {
+        return;
+    }
+    unsigned long t = micros();
+    display->area_update_end();
+    t = micros() - t;
+    frameDisplayUs += t;
+    VNC_TRACE_EVENT(VNC_TRACE_DISPLAY, clip->vx, clip->vy, clip->vw, clip->vh, t);
+    if(statsEnabled) {
+        _stats_pixels(clip->vx, clip->vy, clip->vw, clip->vh);
+    }
+}
+
+//#############################################################################################
+//                                      Buffer pool
+//#############################################################################################
+
+VNCbufferPool::VNCbufferPool() {
+    raw = NULL;
+    hextile = NULL;
+    for(uint8_t n = 0; n < VNC_AREA_BUFFERS; n++) {
+        tile[n] = NULL;
+        zrleTile[n] = NULL;
+        tileDone[n].busy = false;
+        tileDone[n].display = NULL;
+        zrleDone[n].busy = false;
+        zrleDone[n].display = NULL;
+    }
+    tileNext = 0;
+    zrleNext = 0;
+    external = false;
+}
+
+VNCbufferPool::~VNCbufferPool() {
+    for(uint8_t n = 0; n < VNC_AREA_BUFFERS; n++) {
+        // a display may still read from the buffers
+        wait(&tileDone[n]);
+        wait(&zrleDone[n]);
+        if(!external) {
+            freeSec(tile[n]);
+            freeSec(zrleTile[n]);
+        }
+    }
+    if(!external) {
+        freeSec(raw);
+        freeSec(hextile);
+    }
+}
+
+/**
+ * bytes of all buffers
+ */
+size_t VNCbufferPool::size(void) {
+    size_t size = 0;
+#ifdef VNC_RAW_BUFFER
+    size += VNCarena::align(VNC_RAW_BUFFER);
+#endif
+#ifdef VNC_HEXTILE
+    size += VNCarena::align(255 * sizeof(HextileSubrectsColoured_t));
+#ifdef VNC_FRAMEBUFFER
+    size += VNCarena::align(16 * 16 * 2) * VNC_AREA_BUFFERS;
+#endif
+#endif
+#ifdef VNC_ZRLE
+    size += VNCarena::align(FB_SIZE * sizeof(uint16_t)) * VNC_AREA_BUFFERS;
+#endif
+    return size;
+}
+
+/**
+ * carve all buffers from the arena instead of allocating them on first use
+ */
+bool VNCbufferPool::begin(VNCarena * arena) {
+    if(external) {
+        return true;
+    }
+    if((arena->size() - arena->used()) < size()) {
+        return false;
+    }
+    external = true;
+#ifdef VNC_RAW_BUFFER
+    raw = (char *) arena->alloc(VNC_RAW_BUFFER);
+#endif
+#ifdef VNC_HEXTILE
+    hextile = (char *) arena->alloc(255 * sizeof(HextileSubrectsColoured_t));
+#ifdef VNC_FRAMEBUFFER
+    for(uint8_t n = 0; n < VNC_AREA_BUFFERS; n++) {
+        tile[n] = (uint8_t *) arena->alloc(16 * 16 * 2);
+    }
+#endif
+#endif
+#ifdef VNC_ZRLE
+    for(uint8_t n = 0; n < VNC_AREA_BUFFERS; n++) {
+        zrleTile[n] = (uint16_t *) arena->alloc(FB_SIZE * sizeof(uint16_t));
+    }
+#endif
+    return true;
+}
+
+void * VNCbufferPool::get(void ** buffer, uint8_t subsystem, size_t size) {
+    if(!*buffer && !external) {
+        *buffer = vnc_malloc(subsystem, size);
+    }
+    return *buffer;
+}
+
+char * VNCbufferPool::getRaw(void) {
+#ifdef VNC_RAW_BUFFER
+    return (char *) get((void **) &raw, VNC_MEM_RAW, VNC_RAW_BUFFER);
+#else
+    return NULL;
+#endif
+}
+
+char * VNCbufferPool::getHextile(void) {
+    return (char *) get((void **) &hextile, VNC_MEM_HEXTILE, 255 * sizeof(HextileSubrectsColoured_t));
+}
+
+/**
+ * next Hextile tile buffer of the rotation, it may still be busy, see done
+ */
+uint8_t * VNCbufferPool::getTile(vnc_area_completion_t ** done) {
+    uint8_t n = tileNext;
+    tileNext = (tileNext + 1) % VNC_AREA_BUFFERS;
+    *done = &tileDone[n];
+    return (uint8_t *) get((void **) &tile[n], VNC_MEM_FRAMEBUFFER, 16 * 16 * 2);
+}
+
+/**
+ * next ZRLE tile buffer of the rotation, it may still be busy, see done
+ */
+uint16_t * VNCbufferPool::getZrleTile(vnc_area_completion_t ** done) {
+    uint8_t n = zrleNext;
+    zrleNext = (zrleNext + 1) % VNC_AREA_BUFFERS;
+    *done = &zrleDone[n];
+#ifdef VNC_ZRLE
+    return (uint16_t *) get((void **) &zrleTile[n], VNC_MEM_FRAMEBUFFER, FB_SIZE * sizeof(uint16_t));
+#else
+    return NULL;
+#endif
+}
+
+void VNCbufferPool::wait(vnc_area_completion_t * done) {
+    if(done->busy && done->display) {
+        done->display->wait_area(done);
+    }
+}
+
+/**
+ * use a pool shared with other clients, call before begin()
+ */
+void arduinoVNC::setBufferPool(VNCbufferPool * _pool) {
+    pool = _pool ? _pool : &ownPool;
+}
+
+#ifdef VNC_ARENA
+/**
+ * use memory of the caller for the decoder buffers, call before begin().
+ * size needs to be at least arenaSize(), false once the buffers are carved.
+ * the cursor sprite and the sendClipboard() text are carved as well,
+ * the handshake strings and the VNC_FRAMEBUFFER copy stay on the heap.
+ * a shared pool, like the one of VNCscheduler, is carved by its owner
+ */
+bool arduinoVNC::setArena(uint8_t * block, size_t size) {
+    if(arena.used()) {
+        // the decoder buffers point into the current block
+        return false;
+    }
+    return arena.begin(block, size);
+}
+
+/**
+ * bytes needed for all decoder buffers, a shared pool is not included
+ */
+size_t arduinoVNC::arenaSize(void) {
+    size_t size = 0;
+    if(pool == &ownPool) {
+        size += VNCbufferPool::size();
+    }
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    if(!inflateExternal) {
+        size += VNCarena::align(ZRLE_INPUT_BUFFER);
+        size += VNCarena::align(ZRLE_OUTPUT_BUFFER);
+    }
+#endif
+#ifdef VNC_RICH_CURSOR
+    // worst case of one run per two pixels
+    size += VNCarena::align(SoftCursorSize(VNC_CURSOR_MAX, VNC_CURSOR_MAX, ((VNC_CURSOR_MAX + 1) / 2) * VNC_CURSOR_MAX));
+#endif
+    size += VNCarena::align(VNC_CLIPBOARD_MAX);
+    return size;
+}
+
+/**
+ * carve all decoder buffers, only done once, no heap use by the decoders afterwards.
+ * false if the arena can not hold them, loop() does not connect then
+ */
+bool arduinoVNC::_arena_init(void) {
+    if(arena.used()) {
+        return true;
+    }
+
+    if(!arena.size() && !arena.begin(arenaSize())) {
+        DEBUG_VNC("[_arena_init] malloc of %zu failed!\n", arenaSize());
+        return false;
+    }
+
+    if(arena.size() < arenaSize()) {
+        DEBUG_VNC("[_arena_init] arena to small %zu < %zu!\n", arena.size(), arenaSize());
+        return false;
+    }
+
+    if(pool == &ownPool) {
+        ownPool.begin(&arena);
+    }
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    if(!inflateExternal) {
+        zin = (uint8_t *) arena.alloc(ZRLE_INPUT_BUFFER);
+        zout = (uint8_t *) arena.alloc(ZRLE_OUTPUT_BUFFER);
+    }
+#endif
+#ifdef VNC_RICH_CURSOR
+    cursorBufferSize = SoftCursorSize(VNC_CURSOR_MAX, VNC_CURSOR_MAX, ((VNC_CURSOR_MAX + 1) / 2) * VNC_CURSOR_MAX);
+    cursorBuffer = (uint8_t *) arena.alloc(cursorBufferSize);
+#endif
+    clipboardBuffer = (uint8_t *) arena.alloc(VNC_CLIPBOARD_MAX);
+    return true;
+}
+#endif
+
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+/**
+ * use inflate buffers of the caller (ZRLE_INPUT_BUFFER and ZRLE_OUTPUT_BUFFER bytes),
+ * NULL runs the session without Zlib and ZRLE.
+ * the inflate stream lives as long as the connection, taking the buffers away
+ * from a connected session closes the connection.
+ */
+void arduinoVNC::setInflateBuffers(uint8_t * in, uint8_t * out) {
+    if(!in || !out) {
+        in = NULL;
+        out = NULL;
+    }
+    bool wasAvailable = (zin != NULL);
+    if(!inflateExternal) {
+#ifndef VNC_ARENA
+        freeSec(zin);
+        freeSec(zout);
+#endif
+        inflateExternal = true;
+    }
+
+    zin = in;
+    zout = out;
+
+    if(!connected() || handshakeState < VNC_HANDSHAKE_RESULT) {
+        // announced with the next handshake
+        _encoding_reset();
+        return;
+    }
+
+    if(wasAvailable) {
+        // the server may still send data of the old stream
+        disconnect();
+        return;
+    }
+
+    if(zin) {
+        // stream was never used by the server, start fresh and announce Zlib and ZRLE
+        _inflate_reset();
+        _encoding_reset();
+        // VNCscheduler may not run loop() of this session for a while
+        if(!rfb_set_encodings() || !_tx_flush()) {
+            disconnect();
+        }
+    }
+}
+
+bool arduinoVNC::_inflate_available(void) {
+    return !inflateExternal || (zin && zout);
+}
+
+void arduinoVNC::_inflate_reset(void) {
+    if(!zout) {
+        return;
+    }
+    tinfl_init(&inflator);
+    // reset dict
+    memset(zout, 0, ZRLE_OUTPUT_BUFFER);
+    zout_next = zout;
+#ifdef VNC_ZRLE
+    zout_read = zout;
+#endif // #ifdef VNC_ZRLE
+}
+
+/**
+ * Zlib and ZRLE are separate zlib streams of the server, but there is only one inflate state.
+ * the first of them used in a connection keeps it, the other one is no longer announced.
+ * false if the server still sends the other one, its stream can not be decoded.
+ */
+bool arduinoVNC::_inflate_claim(int32_t encoding) {
+    if(inflateEncoding == encoding) {
+        return true;
+    }
+    if(inflateEncoding) {
+        DEBUG_VNC("[_inflate_claim] inflate state is used by %d, can not decode %d!\n", inflateEncoding, encoding);
+        return false;
+    }
+
+    inflateEncoding = encoding;
+    int32_t other = (encoding == rfbEncodingZlib) ? rfbEncodingZRLE : rfbEncodingZlib;
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        if(encodings[i].encoding == other) {
+            encodingCount--;
+            memmove(&encodings[i], &encodings[i + 1], (encodingCount - i) * sizeof(vnc_encoding_cost_t));
+            memset(&encodings[encodingCount], 0, sizeof(vnc_encoding_cost_t));
+            DEBUG_VNC("[_inflate_claim] inflate state used by %d, %d disabled\n", encoding, other);
+            return rfb_set_encodings();
+        }
+    }
+    return true;
+}
+#endif
+
+//#############################################################################################
+//                                      Rate control
+//#############################################################################################
+
+/**
+ * exponential moving average, 1/8 weight for the new sample
+ */
+static inline void rate_average(uint32_t * estimate, uint32_t sample) {
+    if(*estimate == 0) {
+        *estimate = sample;
+    } else {
+        *estimate = *estimate - (*estimate >> 3) + (sample >> 3);
+    }
+}
+
+static void histogram_add(vnc_histogram_t * histogram, uint32_t us) {
+    uint8_t n = 31 - __builtin_clz(us | 1);
+    histogram->bucket[min(n, (uint8_t) (VNC_HISTOGRAM_BUCKETS - 1))]++;
+    histogram->count++;
+    histogram->maxUs = max(histogram->maxUs, us);
+}
+
+/**
+ * upper bound in us of the bucket holding the percentile
+ */
+uint32_t vnc_histogram_percentile(const vnc_histogram_t * histogram, uint8_t percent) {
+    uint32_t limit = (uint32_t) (((uint64_t) histogram->count * percent + 99) / 100);
+    uint32_t sum = 0;
+    for(uint8_t n = 0; n < VNC_HISTOGRAM_BUCKETS; n++) {
+        sum += histogram->bucket[n];
+        if(sum >= limit && sum > 0) {
+            return min((uint32_t) 1 << (n + 1), histogram->maxUs);
+        }
+    }
+    return histogram->maxUs;
+}
+
+void arduinoVNC::_rate_reset(void) {
+    memset(&rate, 0, sizeof(rate));
+    rate.requestIntervalUs = (uint32_t) updateDelay * 1000;
+    rate.depth = updateDepth;
+    lastRequestUs = micros() - rate.requestIntervalUs;
+    rttProbeUs = 0;
+    rttProbeFull = false;
+    fenceSentUs = 0;
+    frameStartUs = 0;
+    frameNetworkUs = 0;
+    frameDisplayUs = 0;
+    frameBytes = 0;
+}
+
+void arduinoVNC::_rate_rtt_sample(uint32_t us) {
+    rate_average(&rate.rttUs, us);
+}
+
+/**
+ * called after the FramebufferUpdate header is received, now is the time of the first byte
+ */
+void arduinoVNC::_rate_frame_start(unsigned long now) {
+    if(rttProbeUs) {
+        if(rttProbeFull) {
+            // an incremental request is answered when something changed, that is idle time
+            _rate_rtt_sample(now - rttProbeUs);
+        }
+        if(statsEnabled) {
+            histogram_add(&stats.requestToFirstByte, now - rttProbeUs);
+        }
+        rttProbeUs = 0;
+    }
+
+    if(frameStartUs) {
+        rate_average(&rate.frameIntervalUs, now - frameStartUs);
+    }
+
+    frameStartUs = now;
+    frameNetworkUs = 0;
+    frameDisplayUs = 0;
+    frameBytes = 0;
+}
+
+/**
+ * update the estimates after a complete FramebufferUpdate and adapt request rate and depth.
+ * requests are not send faster then the frames can be decoded and displayed,
+ * the depth covers the round trip time with frames in flight.
+ */
+void arduinoVNC::_rate_frame_done(void) {
+    uint32_t frameUs = micros() - frameStartUs;
+    uint32_t busyUs = frameDisplayUs + frameNetworkUs;
+
+    if(statsEnabled) {
+        _stats_frame_done(frameUs);
+    }
+
+    if(connectStartUs) {
+        stats.firstFrameUs = micros() - connectStartUs;
+        connectStartUs = 0;
+        DEBUG_VNC("[VNC-CLIENT] connect: %dus, first frame: %dus\n", (int) stats.connectUs, (int) stats.firstFrameUs);
+    }
+
+    rate_average(&rate.decodeUs, (frameUs > busyUs) ? (frameUs - busyUs) : 0);
+    rate_average(&rate.displayUs, frameDisplayUs);
+    rate_average(&rate.networkUs, frameNetworkUs);
+    rate_average(&rate.frameBytes, frameBytes);
+
+    if(rate.frameIntervalUs) {
+        rate.bytesPerSecond = (uint32_t) (((uint64_t) rate.frameBytes * 1000000) / rate.frameIntervalUs);
+    }
+
+    uint32_t cpuUs = rate.decodeUs + rate.displayUs;
+    rate.requestIntervalUs = max((uint32_t) updateDelay * 1000, cpuUs);
+    rate.depth = constrain((rate.rttUs / max(cpuUs, (uint32_t) 1)) + 1, (uint32_t) 1, (uint32_t) updateDepth);
+}
+
+//#############################################################################################
+//                                      Statistics
+//#############################################################################################
+
+/**
+ * collect per encoding counters, disabled by default
+ */
+void arduinoVNC::enableStats(bool enable) {
+    statsEnabled = enable;
+}
+
+void arduinoVNC::resetStats(void) {
+    memset(&stats, 0, sizeof(stats));
+    memset(&statsFrame, 0, sizeof(statsFrame));
+    inputUs = 0;
+}
+
+const vnc_stats_t & arduinoVNC::getStats(void) {
+    stats.memory = vnc_memory_stats();
+    return stats;
+}
+
+#ifdef VNC_TRACE
+/**
+ * event ring buffer, dump with getTrace().dumpChromeTrace(Serial)
+ */
+VNCtrace & arduinoVNC::getTrace(void) {
+    return trace;
+}
+#endif
+
+static void stats_add(vnc_stats_counter_t * counter, vnc_stats_counter_t * rect) {
+    counter->rects += rect->rects;
+    counter->pixels += rect->pixels;
+    counter->bytes += rect->bytes;
+    counter->decodeUs += rect->decodeUs;
+    counter->displayUs += rect->displayUs;
+    counter->networkUs += rect->networkUs;
+}
+
+void arduinoVNC::_stats_rect(int32_t encoding, vnc_stats_counter_t * rect) {
+    uint8_t slot;
+    switch(encoding) {
+        case rfbEncodingRaw:
+            slot = VNC_STATS_RAW;
+            break;
+        case rfbEncodingCopyRect:
+            slot = VNC_STATS_COPYRECT;
+            break;
+        case rfbEncodingRRE:
+            slot = VNC_STATS_RRE;
+            break;
+        case rfbEncodingCoRRE:
+            slot = VNC_STATS_CORRE;
+            break;
+        case rfbEncodingHextile:
+            slot = VNC_STATS_HEXTILE;
+            break;
+        case rfbEncodingZlib:
+            slot = VNC_STATS_ZLIB;
+            break;
+        case rfbEncodingTight:
+            slot = VNC_STATS_TIGHT;
+            break;
+        case rfbEncodingZRLE:
+            slot = VNC_STATS_ZRLE;
+            break;
+        case (int32_t) rfbEncodingXCursor:
+        case (int32_t) rfbEncodingRichCursor:
+        case (int32_t) rfbEncodingPointerPos:
+            slot = VNC_STATS_CURSOR;
+            break;
+        default:
+            slot = VNC_STATS_OTHER;
+            break;
+    }
+
+    vnc_stats_counter_t counter = *rect;
+    counter.bytes += sz_rfbFramebufferUpdateRectHeader;
+    stats_add(&stats.encoding[slot], &counter);
+    stats_add(&stats.total, &counter);
+    stats_add(&statsFrame, &counter);
+}
+
+void arduinoVNC::_stats_frame_done(uint32_t frameUs) {
+    stats.frames++;
+    stats.lastFrameUs = frameUs;
+    stats.lastFrame = statsFrame;
+    memset(&statsFrame, 0, sizeof(statsFrame));
+    histogram_add(&stats.firstByteToFrame, frameUs);
+}
+
+/**
+ * a pointer event was send, the measurement starts at the first event without reaction
+ */
+void arduinoVNC::_stats_input(void) {
+    inputX = (int32_t) mousestate.x - opt.v_offset;
+    inputY = (int32_t) mousestate.y - opt.h_offset;
+    if(!inputUs) {
+        inputUs = micros() | 1;
+    }
+}
+
+/**
+ * pixels of the display are changed, check if they are near the last pointer event
+ */
+void arduinoVNC::_stats_pixels(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    if(!inputUs) {
+        return;
+    }
+
+    uint32_t us = micros() - inputUs;
+    if(us > (VNC_INPUT_LATENCY_TIMEOUT * 1000UL)) {
+        inputUs = 0;
+        return;
+    }
+
+    if(((int32_t) (x + w) + VNC_INPUT_LATENCY_RADIUS) > inputX && ((int32_t) x - VNC_INPUT_LATENCY_RADIUS) <= inputX &&
+       ((int32_t) (y + h) + VNC_INPUT_LATENCY_RADIUS) > inputY && ((int32_t) y - VNC_INPUT_LATENCY_RADIUS) <= inputY) {
+        histogram_add(&stats.inputToPixel, us);
+        inputUs = 0;
+    }
+}
+
+//#############################################################################################
+//                                      Encoding selection
+//#############################################################################################
+
+void arduinoVNC::_encoding_reset(void) {
+    encodingCount = 0;
+    memset(&encodings, 0, sizeof(encodings));
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    bool inflate = _inflate_available();
+#endif
+#ifdef VNC_ZRLE
+    if(inflate && inflateEncoding != rfbEncodingZlib) {
+        encodings[encodingCount++].encoding = rfbEncodingZRLE;
+    }
+#endif
+#ifdef VNC_TIGHT
+    encodings[encodingCount++].encoding = rfbEncodingTight;
+#endif
+#ifdef VNC_HEXTILE
+    encodings[encodingCount++].encoding = rfbEncodingHextile;
+#endif
+#ifdef VNC_ZLIB
+    if(inflate && inflateEncoding != rfbEncodingZRLE) {
+        encodings[encodingCount++].encoding = rfbEncodingZlib;
+    }
+#endif
+#ifdef VNC_RRE
+    encodings[encodingCount++].encoding = rfbEncodingRRE;
+#endif
+#ifdef VNC_CORRE
+    encodings[encodingCount++].encoding = rfbEncodingCoRRE;
+#endif
+    encodings[encodingCount++].encoding = rfbEncodingRaw;
+    lastEncodingCheck = millis();
+}
+
+#ifdef VNC_ADAPTIVE_ENCODING
+/**
+ * record wire bytes and decode time of a rectangle
+ */
+void arduinoVNC::_encoding_sample(int32_t encoding, vnc_stats_counter_t * rect) {
+    if(rect->pixels < VNC_ENCODING_MIN_PIXELS) {
+        return;
+    }
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        if(encodings[i].encoding == encoding) {
+            rate_average(&encodings[i].bytesPerKPixel, max((uint32_t) (((uint64_t) rect->bytes * 1024) / rect->pixels), (uint32_t) 1));
+            rate_average(&encodings[i].decodeUsPerKPixel, max((uint32_t) (((uint64_t) rect->decodeUs * 1024) / rect->pixels), (uint32_t) 1));
+            return;
+        }
+    }
+}
+
+/**
+ * reorder the encodings by their cost with the current bottleneck.
+ * the network cost of a byte is the time spent waiting for data per received byte,
+ * near zero when the CPU is the bottleneck, so the cheapest decoder wins,
+ * high when the network is the bottleneck, so the smallest encoding wins.
+ * encodings without measurement are tried once.
+ */
+bool arduinoVNC::_encoding_adapt(void) {
+    if(!rate.frameBytes) {
+        return true;
+    }
+
+    int32_t before[MAX_IMAGE_ENCODINGS];
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        before[i] = encodings[i].encoding;
+    }
+
+    uint32_t cpuUs = rate.decodeUs + rate.displayUs;
+    uint32_t waitUsPerKByte = (uint32_t) (((uint64_t) rate.networkUs * 1024) / rate.frameBytes);
+
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        vnc_encoding_cost_t * e = &encodings[i];
+        if(!e->bytesPerKPixel) {
+            e->costUs = UINT32_MAX;
+        } else {
+            e->costUs = e->decodeUsPerKPixel + (uint32_t) (((uint64_t) e->bytesPerKPixel * waitUsPerKByte) / 1024);
+        }
+    }
+
+    // insertion sort, stable for equal costs
+    for(uint8_t i = 1; i < encodingCount; i++) {
+        vnc_encoding_cost_t e = encodings[i];
+        uint8_t n = i;
+        while(n > 0 && encodings[n - 1].costUs > e.costUs) {
+            encodings[n] = encodings[n - 1];
+            n--;
+        }
+        encodings[n] = e;
+    }
+
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        vnc_encoding_cost_t e = encodings[i];
+        if(e.bytesPerKPixel || e.probed || e.encoding == rfbEncodingRaw) {
+            continue;
+        }
+        e.probed = true;
+        memmove(&encodings[1], &encodings[0], i * sizeof(vnc_encoding_cost_t));
+        encodings[0] = e;
+        break;
+    }
+
+    bool changed = false;
+    for(uint8_t i = 0; i < encodingCount; i++) {
+        if(before[i] != encodings[i].encoding) {
+            changed = true;
+        }
+    }
+
+    if(opt.client.compresslevel <= 9) {
+        if(rate.networkUs > cpuUs && opt.client.compresslevel < 9) {
+            opt.client.compresslevel++;
+            changed = true;
+        } else if(rate.networkUs < (cpuUs / 4) && opt.client.compresslevel > 1) {
+            opt.client.compresslevel--;
+            changed = true;
+        }
+    }
+
+    if(!changed) {
+        return true;
+    }
+
+    DEBUG_VNC("[_encoding_adapt] network: %dus cpu: %dus preferred: %d compresslevel: %d\n", rate.networkUs, cpuUs, encodings[0].encoding, opt.client.compresslevel);
+    return rfb_set_encodings();
+}
+#endif
+
+//#############################################################################################
+//                                      Encryption
+//#############################################################################################
+
+void arduinoVNC::vncRandomBytes(unsigned char *bytes) {
+#ifdef ESP8266
+    srand(RANDOM_REG32);
+#else
+    // todo find better seed
+    srand(millis());
+#endif
+    for(int i = 0; i < CHALLENGESIZE; i++) {
+        bytes[i] = (unsigned char) (rand() & 255);
+    }
+}
+
+void arduinoVNC::vncEncryptBytes(unsigned char *bytes, char *passwd) {
+    unsigned char key[8];
+    size_t i;
+
+    /* key is simply password padded with nulls */
+
+    for(i = 0; i < 8; i++) {
+        if(i < strlen(passwd)) {
+            key[i] = passwd[i];
+        } else {
+            key[i] = 0;
+        }
+    }
+
+    deskey(key, EN0);
+
+    for(i = 0; i < CHALLENGESIZE; i += 8) {
+        des(bytes + i, bytes + i);
+    }
+}
+
+//#############################################################################################
+//                                      Cursor
+//#############################################################################################
+
+#ifdef VNC_RICH_CURSOR
+void arduinoVNC::SoftCursorMove(int x, int y) {
+    if(x == cursorX && y == cursorY) {
+        return;
+    }
+    // only the old and the new bounding box of the cursor are redrawn
+    SoftCursorHide();
+    cursorX = x;
+    cursorY = y;
+    SoftCursorShow();
+}
+
+/**
+ * save the display pixels under the cursor and draw the cursor over them
+ */
+void arduinoVNC::SoftCursorShow(void) {
+    if(cursorShown || !cursorW || !display->hasReadArea()) {
+        return;
+    }
+
+    // the hotspot may move the cursor left / above of the framebuffer, _clip_rect works signed
+    _clip_rect(&cursorClip, (uint32_t) (cursorX - cursorHotX), (uint32_t) (cursorY - cursorHotY), cursorW, cursorH);
+    if(cursorClip.allHidden) {
+        return;
+    }
+
+    _clip_fill_flush();
+    unsigned long t = micros();
+    display->read_area(cursorClip.vx, cursorClip.vy, cursorClip.vw, cursorClip.vh, cursorSave);
+
+    // background, then the opaque runs of the visible part
+    uint8_t bpp = cursorBytesPerPixel;
+    memcpy(cursorImage, cursorSave, cursorClip.vw * cursorClip.vh * bpp);
+    int32_t col1 = cursorClip.vx - cursorClip.x;
+    int32_t col2 = col1 + cursorClip.vw;
+    int32_t row1 = cursorClip.vy - cursorClip.y;
+    int32_t row2 = row1 + cursorClip.vh;
+    for(uint16_t i = 0; i < cursorRunCount; i++) {
+        vnc_cursor_run_t * run = &cursorRuns[i];
+        int32_t x1 = max((int32_t) run->x, col1);
+        int32_t x2 = min((int32_t) (run->x + run->w), col2);
+        if(run->y < row1 || run->y >= row2 || x2 <= x1) {
+            continue;
+        }
+        memcpy(cursorImage + (((run->y - row1) * cursorClip.vw) + (x1 - col1)) * bpp, cursorPixels + ((run->y * cursorW) + x1) * bpp, (x2 - x1) * bpp);
+    }
+
+    display->draw_area(cursorClip.vx, cursorClip.vy, cursorClip.vw, cursorClip.vh, cursorImage);
+    frameDisplayUs += (micros() - t);
+    cursorShown = true;
+}
+
+/**
+ * put the saved pixels back
+ */
+void arduinoVNC::SoftCursorHide(void) {
+    if(!cursorShown) {
+        return;
+    }
+    cursorShown = false;
+    _clip_fill_flush();
+    unsigned long t = micros();
+    display->draw_area(cursorClip.vx, cursorClip.vy, cursorClip.vw, cursorClip.vh, cursorSave);
+    frameDisplayUs += (micros() - t);
+}
+
+/**
+ * hide the cursor before the server draws below it, it is shown again at the end of the FramebufferUpdate
+ */
+void arduinoVNC::SoftCursorLockArea(int x, int y, int w, int h) {
+    if(!cursorShown) {
+        return;
+    }
+    int32_t cx = cursorX - cursorHotX;
+    int32_t cy = cursorY - cursorHotY;
+    if(x < (cx + cursorW) && cx < (x + w) && y < (cy + cursorH) && cy < (y + h)) {
+        SoftCursorHide();
+    }
+}
+
+void arduinoVNC::SoftCursorFree(void) {
+#ifndef VNC_ARENA
+    freeSec(cursorBuffer);
+    cursorBufferSize = 0;
+#endif
+    cursorW = cursorH = 0;
+}
+
+size_t arduinoVNC::SoftCursorSize(uint16_t w, uint16_t h, uint16_t runs) {
+    size_t pixelSize = w * h * (opt.client.bpp / 8);
+    size_t maskSize = (((w + 7) / 8) * h + 3) & ~((size_t) 3);
+    return (pixelSize * 3) + maskSize + (runs * sizeof(vnc_cursor_run_t));
+}
+
+/**
+ * carve sprite, save-under, image, mask and runs from cursorBuffer, it only grows
+ * the layout does not depend on runs, growing it later keeps sprite and mask
+ */
+bool arduinoVNC::SoftCursorAlloc(uint16_t w, uint16_t h, uint16_t runs) {
+    cursorBytesPerPixel = (opt.client.bpp / 8);
+    size_t pixelSize = w * h * cursorBytesPerPixel;
+    size_t maskSize = (((w + 7) / 8) * h + 3) & ~((size_t) 3);
+    size_t size = SoftCursorSize(w, h, runs);
+
+    if(size > cursorBufferSize) {
+#ifdef VNC_ARENA
+        // carved at VNC_CURSOR_MAX by _arena_init()
+        return false;
+#else
+        uint8_t * buffer = (uint8_t *) vnc_realloc(VNC_MEM_CURSOR, cursorBuffer, size);
+        if(!buffer) {
+            return false;
+        }
+        cursorBuffer = buffer;
+        cursorBufferSize = size;
+#endif
+    }
+
+    cursorPixels = cursorBuffer;
+    cursorSave = cursorPixels + pixelSize;
+    cursorImage = cursorSave + pixelSize;
+    cursorMask = cursorImage + pixelSize;
+    cursorRuns = (vnc_cursor_run_t *) (cursorMask + maskSize);
+    return true;
+}
+
+/**
+ * spans of opaque pixels, the cursor is drawn with one memcpy per span
+ * first pass counts them so the run table is sized exactly
+ */
+bool arduinoVNC::SoftCursorRuns(void) {
+    size_t bytesPerRow = (cursorW + 7) / 8;
+    uint16_t count = 0;
+    for(uint16_t y = 0; y < cursorH; y++) {
+        uint8_t * row = cursorMask + (y * bytesPerRow);
+        bool opaque = false;
+        for(uint16_t x = 0; x < cursorW; x++) {
+            bool bit = (row[x / 8] & (0x80 >> (x % 8)));
+            if(bit && !opaque) {
+                count++;
+            }
+            opaque = bit;
+        }
+    }
+
+    if(!SoftCursorAlloc(cursorW, cursorH, count)) {
+        return false;
+    }
+
+    cursorRunCount = 0;
+    for(uint16_t y = 0; y < cursorH; y++) {
+        uint8_t * row = cursorMask + (y * bytesPerRow);
+        uint16_t x = 0;
+        while(x < cursorW) {
+            if(!(row[x / 8] & (0x80 >> (x % 8)))) {
+                x++;
+                continue;
+            }
+            vnc_cursor_run_t * run = &cursorRuns[cursorRunCount++];
+            run->x = x;
+            run->y = y;
+            while(x < cursorW && (row[x / 8] & (0x80 >> (x % 8)))) {
+                x++;
+            }
+            run->w = x - run->x;
+        }
+    }
+    return true;
+}
+
+/**
+ * 24 bit RGB of XCursor to the client pixel format
+ */
+void arduinoVNC::SoftCursorColor(uint8_t * rgb, uint8_t * pixel) {
+    uint32_t color = (((rgb[0] * opt.client.redmax + 127) / 255) << opt.client.redshift) |
+                     (((rgb[1] * opt.client.greenmax + 127) / 255) << opt.client.greenshift) |
+                     (((rgb[2] * opt.client.bluemax + 127) / 255) << opt.client.blueshift);
+    for(uint8_t i = 0; i < cursorBytesPerPixel; i++) {
+        uint8_t shift = opt.client.bigendian ? (cursorBytesPerPixel - 1 - i) * 8 : i * 8;
+        pixel[i] = (color >> shift) & 0xFF;
+    }
 }
 #endif
@@ -30,10 +30,11 @@
 
 #include "VNC_config.h"
 
-/// more save free
-#define freeSec(ptr) free(ptr); ptr = 0
-
 #include "Arduino.h"
+#include "VNC_memory.h"
+
+/// more save free, for memory from vnc_malloc
+#define freeSec(ptr) vnc_free(ptr); ptr = 0
 
 #if defined(VNC_ZRLE) || defined(VNC_ZLIB)
 #if defined(ESP32)
@@ -61,6 +62,7 @@
 #define CHALLENGESIZE 16
 
 #define MAX_ENCODINGS 20
+#define MAX_IMAGE_ENCODINGS 7
 
 #ifdef WORDS_BIGENDIAN
 #define Swap16IfLE(s) (s)
@@ -141,6 +143,135 @@ typedef struct
    unsigned int buttonmask;
 } mousestate_t;
 
+/// visible part of a server rectangle on the display
+typedef struct
+{
+   int32_t x;        // rectangle position in display coordinates (may be negative)
+   int32_t y;
+   uint32_t w;
+   uint32_t h;
+   uint32_t vx;      // visible window in display coordinates
+   uint32_t vy;
+   uint32_t vw;
+   uint32_t vh;
+   uint32_t pixel;   // pixels of the rectangle already streamed
+   bool allVisible;
+   bool allHidden;
+} clip_t;
+
+/// queued fill in display coordinates, already clipped
+typedef struct {
+   uint16_t x;
+   uint16_t y;
+   uint16_t w;
+   uint16_t h;
+   uint16_t color;
+} vnc_fill_t;
+
+/// opaque pixels in one row of the cursor sprite
+typedef struct {
+   uint16_t x;
+   uint16_t y;
+   uint16_t w;
+} vnc_cursor_run_t;
+
+class VNCdisplay;
+
+/**
+ * ServerCutText (Latin-1) in chunks, text is 0 terminated,
+ * length is the announced length limited to maxLength, the chunk with offset + len == length is the last
+ */
+typedef void (*vnc_cut_text_cb_t)(void * arg, const char * text, size_t len, uint32_t offset, uint32_t length);
+
+/// state of one buffer handed to VNCdisplay::submit_area
+typedef struct {
+   volatile bool busy;    // cleared by the display when the data is no longer needed
+   VNCdisplay * display;  // display the buffer was submitted to
+} vnc_area_completion_t;
+
+typedef struct {
+   uint32_t decodeUs;        // per frame, without display and network wait
+   uint32_t displayUs;       // per frame, time spent in the display driver
+   uint32_t networkUs;       // per frame, time waiting for data of the frame
+   uint32_t frameIntervalUs; // time between FramebufferUpdates
+   uint32_t frameBytes;      // bytes per FramebufferUpdate
+   uint32_t bytesPerSecond;  // network arrival rate
+   uint32_t rttUs;           // Fence round trip or non-incremental request to FramebufferUpdate
+   uint32_t requestIntervalUs; // current pause between FramebufferUpdateRequests
+   uint8_t depth;            // current FramebufferUpdateRequests in flight
+} vnc_rate_t;
+
+/// handshake steps, in protocol order
+enum {
+   VNC_HANDSHAKE_VERSION,
+   VNC_HANDSHAKE_SECURITY,
+   VNC_HANDSHAKE_SECURITY_TYPES,
+   VNC_HANDSHAKE_CHALLENGE,
+   VNC_HANDSHAKE_REASON,
+   VNC_HANDSHAKE_REASON_TEXT,
+   VNC_HANDSHAKE_RESULT,       // pixel format and encodings are sent from here on
+   VNC_HANDSHAKE_SERVER_INIT,
+   VNC_HANDSHAKE_SERVER_NAME,
+   VNC_HANDSHAKE_DONE
+};
+
+enum {
+   VNC_STATS_RAW,
+   VNC_STATS_COPYRECT,
+   VNC_STATS_RRE,
+   VNC_STATS_CORRE,
+   VNC_STATS_HEXTILE,
+   VNC_STATS_ZLIB,
+   VNC_STATS_TIGHT,
+   VNC_STATS_ZRLE,
+   VNC_STATS_CURSOR,         // RichCursor, XCursor and PointerPos
+   VNC_STATS_OTHER,          // other pseudo encodings
+   VNC_STATS_ENCODINGS
+};
+
+/// counters wrap around, use differences between two reads
+typedef struct {
+   uint32_t rects;
+   uint32_t pixels;
+   uint32_t bytes;           // wire bytes including the rectangle header
+   uint32_t decodeUs;        // without display and network wait
+   uint32_t displayUs;       // time spent in the display driver
+   uint32_t networkUs;       // time waiting for data
+} vnc_stats_counter_t;
+
+#define VNC_HISTOGRAM_BUCKETS 24
+
+/// log2 histogram, bucket n counts samples below 2^(n+1) us
+typedef struct {
+   uint32_t count;
+   uint32_t maxUs;
+   uint32_t bucket[VNC_HISTOGRAM_BUCKETS];
+} vnc_histogram_t;
+
+uint32_t vnc_histogram_percentile(const vnc_histogram_t * histogram, uint8_t percent);
+
+typedef struct {
+   vnc_stats_counter_t encoding[VNC_STATS_ENCODINGS];
+   vnc_stats_counter_t total;
+   vnc_stats_counter_t lastFrame; // totals of the last FramebufferUpdate
+   uint32_t frames;
+   uint32_t lastFrameUs;     // wall time of the last FramebufferUpdate
+   vnc_histogram_t requestToFirstByte; // FramebufferUpdateRequest to first byte of the FramebufferUpdate
+   vnc_histogram_t firstByteToFrame;   // first byte to complete FramebufferUpdate
+   vnc_histogram_t inputToPixel;       // pointer event to next pixel change near the pointer
+   uint32_t connectUs;                 // TCP connect to ServerInit of the last connect, always updated
+   uint32_t firstFrameUs;              // TCP connect to the end of the first FramebufferUpdate, always updated
+   vnc_memory_stats_t memory;          // heap use of all clients, always updated
+} vnc_stats_t;
+
+typedef struct {
+   int32_t encoding;
+   uint32_t bytesPerKPixel;    // wire bytes per 1024 pixel
+   uint32_t decodeUsPerKPixel; // decode time per 1024 pixel, without display and network wait
+   uint32_t costUs;            // estimated time per 1024 pixel with the current bottleneck
+   bool probed;
+} vnc_encoding_cost_t;
+
 
 #include "rfbproto.h"
 
@@ -148,6 +279,8 @@ typedef struct
 #include "frameBuffer.h"
 #endif
 
+#include "VNC_trace.h"
+
 class VNCdisplay {
     protected:
         VNCdisplay() {}
@@ -169,12 +302,68 @@ class VNCdisplay {
         virtual void area_update_end(void) = 0;
 
         virtual void vnc_options_override(dfb_vnc_options * opt) {};
+
+        /**
+         * read back pixels in the format of draw_area, needed for the soft cursor (VNC_RICH_CURSOR)
+         */
+        virtual bool hasReadArea(void) { return false; }
+        virtual void read_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *data) {};
+
+        /**
+         * draw_area without waiting for the transfer,
+         * the display clears done->busy when data can be overwritten (e.g. DMA complete)
+         */
+        virtual void submit_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t *data, vnc_area_completion_t * done) {
+            draw_area(x, y, w, h, data);
+            done->busy = false;
+        }
+
+        /**
+         * block until done->busy is cleared
+         */
+        virtual void wait_area(vnc_area_completion_t * done) {
+            while(done->busy) {
+                delay(0);
+            }
+        }
+};
+
+/**
+ * decoder buffers, they hold no state between two server messages
+ * and can be shared by several arduinoVNC running in the same task
+ */
+class VNCbufferPool {
+    public:
+        VNCbufferPool();
+        ~VNCbufferPool();
+
+        bool begin(VNCarena * arena);
+        static size_t size(void);
+
+        char * getRaw(void);
+        char * getHextile(void);
+        uint8_t * getTile(vnc_area_completion_t ** done);
+        uint16_t * getZrleTile(vnc_area_completion_t ** done);
+
+    private:
+        char * raw;
+        char * hextile;
+        uint8_t * tile[VNC_AREA_BUFFERS];
+        uint16_t * zrleTile[VNC_AREA_BUFFERS];
+        vnc_area_completion_t tileDone[VNC_AREA_BUFFERS];
+        vnc_area_completion_t zrleDone[VNC_AREA_BUFFERS];
+        uint8_t tileNext;
+        uint8_t zrleNext;
+        bool external;
+
+        void * get(void ** buffer, uint8_t subsystem, size_t size);
+        void wait(vnc_area_completion_t * done);
 };
 
 class arduinoVNC {
     public:
         arduinoVNC(VNCdisplay * display);
-        ~arduinoVNC(void);
+        virtual ~arduinoVNC(void);
 
         void begin(char *host, uint16_t port = 5900, bool onlyFullUpdate = false);
         void begin(const char *host, uint16_t port = 5900, bool onlyFullUpdate = false);
@@ -188,22 +377,138 @@ class arduinoVNC {
         void reconnect(void);
 
         void loop(void);
+        bool pending(void);
+        void setLoopBudget(uint32_t us);
 
         int forceFullUpdate(void);
 
+#ifdef VNC_ARENA
+        bool setArena(uint8_t * block, size_t size);
+        size_t arenaSize(void);
+#endif
+
+        void setBufferPool(VNCbufferPool * pool);
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+        void setInflateBuffers(uint8_t * in, uint8_t * out);
+#endif
+
         void setMaxFPS(uint16_t fps);
+        void setPipelineDepth(uint8_t depth);
+        vnc_rate_t getRateEstimates(void);
+
+        void enableStats(bool enable = true);
+        void resetStats(void);
+        const vnc_stats_t & getStats(void);
+
+#ifdef VNC_TRACE
+        VNCtrace & getTrace(void);
+#endif
         void mouseEvent(uint16_t x, uint16_t y, uint8_t buttonMask);
         void keyEvent(int key, int keyMask);
 
         void setOffset(uint16_t x, uint16_t y);
 
+        void setCutTextCallback(vnc_cut_text_cb_t cb, void * arg = NULL, uint32_t maxLength = VNC_CUTTEXT_MAX);
+
+        bool sendClipboard(const char * text, size_t len);
+        bool sendClipboard(const char * text);
+        bool sendClipboard(String text);
+
+        bool flush(void);
+
     private:
         bool onlyFullUpdate;
         int port;
         String host;
         String password;
         uint16_t updateDelay;
-
+        uint16_t updateFails;
+
+        /// Reconnect
+        unsigned long connectStartUs;  // until the first FramebufferUpdate is complete
+        unsigned long reconnectMs;     // time of the last failed attempt
+        uint16_t reconnectDelay;       // 0 = connect at once
+        void _reconnect_failed(void);
+
+        /// Handshake, advanced by loop() as the server data arrives
+        uint8_t handshakeState;
+        unsigned long handshakeMs;     // last progress
+        uint32_t handshakeLength;      // security types, reason or server name still to read
+
+        /// FramebufferUpdate, the rects are decoded over several loop() calls with a budget
+        uint32_t loopBudgetUs;         // 0 = whole FramebufferUpdate in one loop()
+        bool fbuActive;
+        bool fbuLastRect;
+        uint16_t fbuRects;
+        uint16_t fbuRect;              // rects already decoded
+
+        /// Desktop size
+        uint16_t desktopWidth;         // framebuffer size of the server, opt.server is clipped to the display
+        uint16_t desktopHeight;
+        uint32_t desktopScreenId;      // first screen of the ExtendedDesktopSize layout
+        bool desktopRequested;         // SetDesktopSize sent in this session
+
+        /// Update request pipeline
+        uint8_t updateDepth;           // max outstanding FramebufferUpdateRequests
+        uint8_t updatesPending;        // FramebufferUpdateRequests without answer
+        unsigned long lastUpdateReceived;
+
+        /// Rate control
+        vnc_rate_t rate;
+        unsigned long lastRequestUs;
+        unsigned long rttProbeUs;      // send time of a request into an empty pipeline
+        bool rttProbeFull;             // the probe is non-incremental, the server answers at once
+        unsigned long fenceSentUs;     // send time of our Fence request
+        unsigned long frameStartUs;
+        uint32_t frameNetworkUs;
+        uint32_t frameDisplayUs;
+        uint32_t frameBytes;
+
+        /// Statistics
+        bool statsEnabled;
+        vnc_stats_t stats;
+        vnc_stats_counter_t statsFrame;
+        unsigned long inputUs;         // first pointer event without pixel change
+        int32_t inputX;                // pointer in display coordinates
+        int32_t inputY;
+
+        /// ServerCutText, read over several loop() calls
+        vnc_cut_text_cb_t cutTextCb;
+        void * cutTextArg;
+        uint32_t cutTextMax;
+        uint32_t cutTextLength;        // bytes announced by the server
+        uint32_t cutTextOffset;        // bytes already read
+
+        /// ClientCutText, sent over several loop() calls
+        uint8_t * clipboardText;       // header is sent, message in progress
+#ifdef VNC_ARENA
+        uint8_t * clipboardBuffer;     // VNC_CLIPBOARD_MAX bytes from the arena
+#endif
+        uint32_t clipboardLength;
+        uint32_t clipboardOffset;
+        uint8_t clipboardHold[VNC_CLIPBOARD_HOLD]; // messages written after the text, in order
+        size_t clipboardHoldLength;
+        size_t clipboardHoldReserve;   // room kept for the releases of held key downs
+
+        /// client messages, written once per loop() or when waiting for the server
+        uint8_t txBuffer[VNC_TX_BUFFER];
+        size_t txLength;
+
+        /// pointer motion is coalesced, at most one PointerEvent per loop()
+        unsigned long inputFlushMs;
+        bool pointerQueued;            // pointer* not yet in txBuffer, replaced by the next motion
+        int pointerX;
+        int pointerY;
+        uint8_t pointerButtons;
+        bool pointerSent;              // pointerSent* is valid
+        int pointerSentX;
+        int pointerSentY;
+        uint8_t pointerSentButtons;
+
+        /// Encoding preferences, best first
+        vnc_encoding_cost_t encodings[MAX_IMAGE_ENCODINGS];
+        uint8_t encodingCount;
+        unsigned long lastEncodingCheck;
 
         VNCdisplay * display;
 
@@ -211,47 +516,89 @@ class arduinoVNC {
 
         uint8_t protocolMinorVersion;
 
+        /// Continuous updates
+        bool cuSupported;       // server sent EndOfContinuousUpdates
+        bool fenceSupported;    // server sent a Fence request
+        bool cuEnabled;         // server pushes updates
+        bool cuPaused;          // disabled until the outstanding Fence returns
+        bool cuStopPending;     // EndOfContinuousUpdates expected for our disable
+        bool fencePending;      // our Fence request is on the way
+        uint8_t cuFramesInFlight;
+
         int sock;
         mousestate_t mousestate;
 
 #ifdef VNC_FRAMEBUFFER
         FrameBuffer fb;
+#endif
+#ifdef VNC_ARENA
+        VNCarena arena;
+        bool _arena_init(void);
+#endif
+
+        /// Decoder buffers
+        VNCbufferPool ownPool;
+        VNCbufferPool * pool;
+
+        /// Fills not yet passed to the display
+        vnc_fill_t fills[VNC_FILL_BATCH];
+        uint8_t fillCount;
+
+#ifdef VNC_TRACE
+        VNCtrace trace;
 #endif
         /// TCP handling
         void disconnect(void);
         bool read_from_rfb_server(int sock, char *out, size_t n);
+        bool skip_from_rfb_server(int sock, size_t n);
         bool write_exact(int sock, char *buf, size_t n);
+        bool _tx_write(const uint8_t * buf, size_t n);
+        bool _tx_flush(void);
         bool set_non_blocking(int sock);
 
 #ifdef VNC_ZRLE
         bool read_from_z(uint8_t *out, size_t n);
+        bool skip_from_z(void);
 #endif // #ifdef VNC_ZRLE
 
         /// Connect to Server
         bool rfb_connect_to_server(const char *server, int display);
         bool rfb_initialise_connection();
 
+        bool _handshake_available(size_t n);
         bool _read_conn_failed_reason(void);
         bool _read_authentication_result(void);
 
         bool _rfb_negotiate_protocol(void);
         bool _rfb_authenticate(void);
-        bool _rfb_initialise_client(void);
+        bool _rfb_initialise_client(bool result);
         bool _rfb_initialise_server(void);
 
 
         bool rfb_set_format_and_encodings();
+        bool rfb_set_encodings();
         bool rfb_set_desktop_size();
         bool rfb_send_update_request(int incremental);
+        bool rfb_send_update_request(int incremental, uint16_t x, uint16_t y, uint16_t w, uint16_t h);
         bool rfb_set_continuous_updates(bool enable);
+        bool rfb_send_fence(CARD32 flags, uint8_t length, char * data);
+        bool rfb_send_fence_request(void);
+        bool rfb_continuous_updates_frame_done(void);
+        bool _rfb_start_continuous_updates(void);
         bool rfb_handle_server_message();
+        bool _handle_framebuffer_update_rects(void);
         bool rfb_update_mouse();
         bool rfb_send_key_event(int key, int down_flag);
+        bool _input_commit_pointer(void);
+        bool _clipboard_send(size_t max);
+        bool _clipboard_hold_room(size_t n, bool release = false);
+        void _clipboard_free(void);
 
         //void rfb_get_rgb_from_data(int *r, int *g, int *b, char *data);
 
         /// Encode handling
         bool _handle_server_cut_text_message(rfbServerToClientMsg * msg);
+        bool _handle_server_cut_text_data(void);
 
         bool _handle_raw_encoded_message(rfbFramebufferUpdateRectHeader rectheader);
         bool _handle_copyrect_encoded_message(rfbFramebufferUpdateRectHeader rectheader);
@@ -261,6 +608,7 @@ class arduinoVNC {
 #endif
 #ifdef VNC_HEXTILE
         bool _handle_hextile_encoded_message(rfbFramebufferUpdateRectHeader rectheader);
+        bool _skip_hextile_encoded_message(rfbFramebufferUpdateRectHeader rectheader);
 #endif
 #ifdef VNC_ZLIB
         bool _handle_zlib_encoded_message(rfbFramebufferUpdateRectHeader rectheader);
@@ -269,11 +617,44 @@ class arduinoVNC {
         bool _handle_zrle_encoded_message(rfbFramebufferUpdateRectHeader rectheader);
 #endif
         bool _handle_cursor_pos_message(rfbFramebufferUpdateRectHeader rectheader);
+        bool _handle_ext_desktop_size_message(rfbFramebufferUpdateRectHeader rectheader);
+        void _desktop_resize(uint16_t w, uint16_t h);
+        void _desktop_offsets(void);
 #ifdef VNC_RICH_CURSOR
         bool _handle_richcursor_message(rfbFramebufferUpdateRectHeader rectheader);
 #endif
 
-        bool _handle_server_continuous_updates_message(rfbFramebufferUpdateRectHeader rectheader);
+        bool _handle_server_continuous_updates_message(void);
+        bool _handle_server_fence_message(rfbServerToClientMsg * msg);
+
+        /// Clipping
+        void _clip_rect(clip_t * clip, uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+        void _clip_draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color);
+        void _clip_draw_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data, vnc_area_completion_t * done = NULL);
+        void _area_wait(vnc_area_completion_t * done);
+        void _clip_area_start(clip_t * clip);
+        void _clip_area_data(clip_t * clip, char * data, uint32_t pixel);
+        void _clip_area_end(clip_t * clip);
+        void _clip_fill_flush(void);
+
+        /// Rate control
+        void _rate_reset(void);
+        void _rate_frame_start(unsigned long startUs);
+        void _rate_rtt_sample(uint32_t us);
+        void _rate_frame_done(void);
+
+        /// Statistics
+        void _stats_rect(int32_t encoding, vnc_stats_counter_t * rect);
+        void _stats_frame_done(uint32_t frameUs);
+        void _stats_input(void);
+        void _stats_pixels(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+
+        /// Encoding selection
+        void _encoding_reset(void);
+#ifdef VNC_ADAPTIVE_ENCODING
+        void _encoding_sample(int32_t encoding, vnc_stats_counter_t * rect);
+        bool _encoding_adapt(void);
+#endif
 
         /// Encryption
         void vncRandomBytes(unsigned char *bytes);
@@ -281,9 +662,32 @@ class arduinoVNC {
 
 #ifdef VNC_RICH_CURSOR
         /// Cursor
-        uint8_t * richCursorData;
-        uint8_t * richCursorMask;
+        uint8_t * cursorBuffer;     // one block for all cursor data, kept across shape updates, from the arena with VNC_ARENA
+        size_t cursorBufferSize;
+        uint8_t * cursorPixels;     // sprite in the pixel format of draw_area
+        uint8_t cursorBytesPerPixel;
+        uint8_t * cursorMask;       // 1 bit per pixel, rows padded to bytes
+        vnc_cursor_run_t * cursorRuns;
+        uint16_t cursorRunCount;
+        uint16_t cursorW;
+        uint16_t cursorH;
+        uint16_t cursorHotX;
+        uint16_t cursorHotY;
+        int32_t cursorX;        // pointer position in framebuffer coordinates
+        int32_t cursorY;
+        uint8_t * cursorSave;   // display pixels under the visible part of the cursor
+        uint8_t * cursorImage;  // cursor blended over cursorSave
+        clip_t cursorClip;      // where cursorSave was read from
+        bool cursorShown;
         void SoftCursorMove(int x, int y);
+        void SoftCursorShow(void);
+        void SoftCursorHide(void);
+        void SoftCursorLockArea(int x, int y, int w, int h);
+        void SoftCursorFree(void);
+        size_t SoftCursorSize(uint16_t w, uint16_t h, uint16_t runs);
+        bool SoftCursorAlloc(uint16_t w, uint16_t h, uint16_t runs = 0);
+        bool SoftCursorRuns(void);
+        void SoftCursorColor(uint8_t * rgb, uint8_t * pixel);
 #endif
 
 #ifdef USE_ARDUINO_TCP
@@ -305,22 +709,30 @@ class arduinoVNC {
 #define ZRLE_OUTPUT_BUFFER (TINFL_LZ_DICT_SIZE * 2)
         tinfl_decompressor inflator;
 
+        // zin / zout belong to the caller, see setInflateBuffers()
+        bool inflateExternal = false;
+
+        // Zlib or ZRLE, the encoding owning the inflate state of this connection, 0 if none
+        int32_t inflateEncoding = 0;
+
+        bool _inflate_available(void);
+        void _inflate_reset(void);
+        bool _inflate_claim(int32_t encoding);
+
         // Input buffer
-        uint8_t *zin;
+        uint8_t *zin = NULL;
 
         // Current read position in input buffer
         uint8_t *zin_next = 0;
 
         // Decompression buffer
-        mz_uint8 *zout;
+        mz_uint8 *zout = NULL;
 
         // Current write position in output buffer
         uint8_t *zout_next;
 #endif
 
 #ifdef VNC_ZRLE
-        uint16_t framebuffer[FB_SIZE];
-
         // number of unprocessed bytes in zin
         size_t bytes_available = 0;
         
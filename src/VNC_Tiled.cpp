@@ -0,0 +1,320 @@
+/*
+ * @file VNC_Tiled.cpp
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "VNC_Tiled.h"
+
+TiledVNC::TiledVNC() {
+    panels = 0;
+    width = 0;
+    height = 0;
+    area_x = area_y = area_w = area_h = 0;
+    area_pos = 0;
+    area_panels = 0;
+    memset(submit, 0, sizeof(submit));
+}
+
+/**
+ * add a panel, x and y are the position of its top left pixel in the composite.
+ * call before arduinoVNC::begin()
+ */
+bool TiledVNC::addPanel(VNCdisplay * display, uint32_t x, uint32_t y) {
+    if(!display || panels >= VNC_TILED_PANELS) {
+        return false;
+    }
+    vnc_panel_t * p = &panel[panels++];
+    p->display = display;
+    p->x = x;
+    p->y = y;
+    p->w = display->getWidth();
+    p->h = display->getHeight();
+    width = max(width, p->x + p->w);
+    height = max(height, p->y + p->h);
+    return true;
+}
+
+bool TiledVNC::hasCopyRect(void) {
+    // a copy between two panels would need to read pixels back
+    return false;
+}
+
+/**
+ * only if every panel can read back
+ */
+bool TiledVNC::hasReadArea(void) {
+    if(!panels) {
+        return false;
+    }
+    for(uint8_t i = 0; i < panels; i++) {
+        if(!panel[i].display->hasReadArea()) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint32_t TiledVNC::getHeight(void) {
+    return height;
+}
+
+uint32_t TiledVNC::getWidth(void) {
+    return width;
+}
+
+/**
+ * part of the rectangle shown by panel i, in composite coordinates (vx, vy, vw, vh)
+ */
+bool TiledVNC::_intersect(uint8_t i, uint32_t x, uint32_t y, uint32_t w, uint32_t h, clip_t * clip) {
+    vnc_panel_t * p = &panel[i];
+    uint32_t x1 = max(x, p->x);
+    uint32_t y1 = max(y, p->y);
+    uint32_t x2 = min(x + w, p->x + p->w);
+    uint32_t y2 = min(y + h, p->y + p->h);
+    if(x1 >= x2 || y1 >= y2) {
+        return false;
+    }
+    clip->vx = x1;
+    clip->vy = y1;
+    clip->vw = x2 - x1;
+    clip->vh = y2 - y1;
+    return true;
+}
+
+void TiledVNC::draw_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data) {
+    clip_t clip;
+    for(uint8_t i = 0; i < panels; i++) {
+        if(!_intersect(i, x, y, w, h, &clip)) {
+            continue;
+        }
+        vnc_panel_t * p = &panel[i];
+        uint8_t * src = data + ((clip.vy - y) * w + (clip.vx - x)) * 2;
+        if(clip.vw == w) {
+            // whole rows, the data is in one piece
+            p->display->draw_area(clip.vx - p->x, clip.vy - p->y, clip.vw, clip.vh, src);
+            continue;
+        }
+        p->display->area_update_start(clip.vx - p->x, clip.vy - p->y, clip.vw, clip.vh);
+        for(uint32_t row = 0; row < clip.vh; row++) {
+            p->display->area_update_data((char *) src, clip.vw);
+            src += w * 2;
+        }
+        p->display->area_update_end();
+    }
+}
+
+/**
+ * every panel gets its part with submit_area, panels on different buses transfer in parallel.
+ * parts that are not whole rows of data are drawn at once.
+ */
+void TiledVNC::submit_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data, vnc_area_completion_t * done) {
+    vnc_tiled_submit_t * slot = _submit_slot(done);
+    if(!slot) {
+        draw_area(x, y, w, h, data);
+        done->busy = false;
+        return;
+    }
+
+    clip_t clip;
+    bool busy = false;
+    for(uint8_t i = 0; i < panels; i++) {
+        if(!_intersect(i, x, y, w, h, &clip)) {
+            continue;
+        }
+        vnc_panel_t * p = &panel[i];
+        uint8_t * src = data + ((clip.vy - y) * w + (clip.vx - x)) * 2;
+        if(clip.vw == w) {
+            vnc_area_completion_t * part = &slot->part[i];
+            part->busy = true;
+            part->display = p->display;
+            p->display->submit_area(clip.vx - p->x, clip.vy - p->y, clip.vw, clip.vh, src, part);
+            busy |= part->busy;
+            continue;
+        }
+        p->display->area_update_start(clip.vx - p->x, clip.vy - p->y, clip.vw, clip.vh);
+        for(uint32_t row = 0; row < clip.vh; row++) {
+            p->display->area_update_data((char *) src, clip.vw);
+            src += w * 2;
+        }
+        p->display->area_update_end();
+    }
+
+    if(busy) {
+        slot->done = done;
+    } else {
+        done->busy = false;
+    }
+}
+
+void TiledVNC::wait_area(vnc_area_completion_t * done) {
+    for(uint8_t n = 0; n < (sizeof(submit) / sizeof(submit[0])); n++) {
+        if(submit[n].done == done) {
+            _submit_wait(&submit[n]);
+            return;
+        }
+    }
+    VNCdisplay::wait_area(done);
+}
+
+/**
+ * free slot for a submit, a slot whose parts are all done is released first
+ */
+TiledVNC::vnc_tiled_submit_t * TiledVNC::_submit_slot(vnc_area_completion_t * done) {
+    vnc_tiled_submit_t * idle = NULL;
+    for(uint8_t n = 0; n < (sizeof(submit) / sizeof(submit[0])); n++) {
+        vnc_tiled_submit_t * slot = &submit[n];
+        if(slot->done == done) {
+            // the buffer is submitted again, the old transfer has to be done
+            _submit_wait(slot);
+            return slot;
+        }
+        if(!idle && !slot->done) {
+            idle = slot;
+        }
+    }
+    if(idle) {
+        return idle;
+    }
+
+    for(uint8_t n = 0; n < (sizeof(submit) / sizeof(submit[0])); n++) {
+        vnc_tiled_submit_t * slot = &submit[n];
+        bool busy = false;
+        for(uint8_t i = 0; i < panels; i++) {
+            busy |= slot->part[i].busy;
+        }
+        if(!busy) {
+            slot->done->busy = false;
+            slot->done = NULL;
+            return slot;
+        }
+    }
+    return NULL;
+}
+
+void TiledVNC::_submit_wait(vnc_tiled_submit_t * slot) {
+    for(uint8_t i = 0; i < panels; i++) {
+        vnc_area_completion_t * part = &slot->part[i];
+        if(part->busy) {
+            part->display->wait_area(part);
+        }
+    }
+    if(slot->done) {
+        slot->done->busy = false;
+        slot->done = NULL;
+    }
+}
+
+void TiledVNC::draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color) {
+    clip_t clip;
+    for(uint8_t i = 0; i < panels; i++) {
+        if(_intersect(i, x, y, w, h, &clip)) {
+            panel[i].display->draw_rect(clip.vx - panel[i].x, clip.vy - panel[i].y, clip.vw, clip.vh, color);
+        }
+    }
+}
+
+void TiledVNC::copy_rect(uint32_t /*src_x*/, uint32_t /*src_y*/, uint32_t /*dest_x*/, uint32_t /*dest_y*/, uint32_t /*w*/, uint32_t /*h*/) {
+}
+
+/**
+ * every panel fills its part, split into rows when the part is not whole rows of data.
+ * pixels in the gaps between the panels are left as they are
+ */
+void TiledVNC::read_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data) {
+    clip_t clip;
+    for(uint8_t i = 0; i < panels; i++) {
+        if(!_intersect(i, x, y, w, h, &clip)) {
+            continue;
+        }
+        vnc_panel_t * p = &panel[i];
+        uint8_t * dst = data + ((clip.vy - y) * w + (clip.vx - x)) * 2;
+        if(clip.vw == w) {
+            p->display->read_area(clip.vx - p->x, clip.vy - p->y, clip.vw, clip.vh, dst);
+            continue;
+        }
+        for(uint32_t row = 0; row < clip.vh; row++) {
+            p->display->read_area(clip.vx - p->x, clip.vy - p->y + row, clip.vw, 1, dst);
+            dst += w * 2;
+        }
+    }
+}
+
+void TiledVNC::area_update_start(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    clip_t clip;
+    area_x = x;
+    area_y = y;
+    area_w = w;
+    area_h = h;
+    area_pos = 0;
+    area_panels = 0;
+    for(uint8_t i = 0; i < panels; i++) {
+        if(_intersect(i, x, y, w, h, &clip)) {
+            area_panels |= (1 << i);
+            panel[i].display->area_update_start(clip.vx - panel[i].x, clip.vy - panel[i].y, clip.vw, clip.vh);
+        }
+    }
+}
+
+/**
+ * split the stream into row pieces, every panel gets the pieces inside its part of the area
+ */
+void TiledVNC::area_update_data(char * data, uint32_t pixel) {
+    while(pixel && area_w) {
+        uint32_t y = area_y + (area_pos / area_w);
+        uint32_t col = area_pos % area_w;
+        uint32_t n = min(pixel, area_w - col);
+
+        for(uint8_t i = 0; i < panels; i++) {
+            vnc_panel_t * p = &panel[i];
+            if(!(area_panels & (1 << i)) || y < p->y || y >= (p->y + p->h)) {
+                continue;
+            }
+            // columns of the panel inside the piece, relative to the area
+            uint32_t start = max(col, max(area_x, p->x) - area_x);
+            uint32_t end = min(col + n, min(area_x + area_w, p->x + p->w) - area_x);
+            if(start < end) {
+                p->display->area_update_data(data + (start - col) * 2, end - start);
+            }
+        }
+
+        data += n * 2;
+        pixel -= n;
+        area_pos += n;
+    }
+}
+
+void TiledVNC::area_update_end(void) {
+    for(uint8_t i = 0; i < panels; i++) {
+        if(area_panels & (1 << i)) {
+            panel[i].display->area_update_end();
+        }
+    }
+    area_panels = 0;
+}
+
+void TiledVNC::vnc_options_override(dfb_vnc_options * opt) {
+    for(uint8_t i = 0; i < panels; i++) {
+        panel[i].display->vnc_options_override(opt);
+    }
+}
@@ -0,0 +1,105 @@
+/*
+ * @file VNC_Tiled.h
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef VNC_TILED_H_
+#define VNC_TILED_H_
+
+#include "VNC_config.h"
+#include "VNC.h"
+
+#if VNC_TILED_PANELS > 8
+#error VNC_TILED_PANELS is limited to 8, the panels of an area are kept in a 8 bit mask
+#endif
+
+/**
+ * one VNCdisplay made of several panels, e.g. 2x2 ILI9341.
+ * every panel shows the part of the composite at its position,
+ * gaps between the panels (bezels) are not shown.
+ * all panels need the same pixel format.
+ */
+class TiledVNC : public VNCdisplay {
+    public:
+        TiledVNC();
+
+        bool addPanel(VNCdisplay * display, uint32_t x, uint32_t y);
+        uint8_t panelCount(void) { return panels; }
+
+        bool hasCopyRect(void);
+        bool hasReadArea(void);
+
+        uint32_t getHeight(void);
+        uint32_t getWidth(void);
+
+        void draw_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data);
+        void submit_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data, vnc_area_completion_t * done);
+        void wait_area(vnc_area_completion_t * done);
+
+        void draw_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint16_t color);
+
+        void copy_rect(uint32_t /*src_x*/, uint32_t /*src_y*/, uint32_t /*dest_x*/, uint32_t /*dest_y*/, uint32_t /*w*/, uint32_t /*h*/);
+
+        void read_area(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint8_t * data);
+
+        void area_update_start(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+        void area_update_data(char * data, uint32_t pixel);
+        void area_update_end(void);
+
+        void vnc_options_override(dfb_vnc_options * opt);
+
+    private:
+        typedef struct {
+            VNCdisplay * display;
+            uint32_t x;
+            uint32_t y;
+            uint32_t w;
+            uint32_t h;
+        } vnc_panel_t;
+
+        /// buffer submitted to the panels, done is released when all parts are
+        typedef struct {
+            vnc_area_completion_t * done;
+            vnc_area_completion_t part[VNC_TILED_PANELS];
+        } vnc_tiled_submit_t;
+
+        vnc_panel_t panel[VNC_TILED_PANELS];
+        uint8_t panels;
+        uint32_t width;
+        uint32_t height;
+
+        /// running area update
+        uint32_t area_x, area_y, area_w, area_h;
+        uint32_t area_pos;      // pixels received
+        uint8_t area_panels;    // bit mask of the panels inside the area
+
+        /// submitted buffers, Hextile and ZRLE rotation
+        vnc_tiled_submit_t submit[VNC_AREA_BUFFERS * 2];
+
+        vnc_tiled_submit_t * _submit_slot(vnc_area_completion_t * done);
+        void _submit_wait(vnc_tiled_submit_t * slot);
+        bool _intersect(uint8_t i, uint32_t x, uint32_t y, uint32_t w, uint32_t h, clip_t * clip);
+};
+
+#endif /* VNC_TILED_H_ */
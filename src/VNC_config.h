@@ -50,28 +50,36 @@
 #define VNC_ZRLE
 #endif
 
+// local cursor with save-under, only advertised if the display has hasReadArea()
+#define VNC_RICH_CURSOR
+
 // not implemented
 //#define VNC_TIGHT
-//#define VNC_RICH_CURSOR
 //#define VNC_SEC_TYPE_TIGHT
 
 /// Buffers
 #define VNC_FRAMEBUFFER
 
 /// Testing
-//#define FPS_BENCHMARK
+//#define FPS_BENCHMARK // request full updates and enable the statistics (getStats)
 //#define FPS_BENCHMARK_FULL
+//#define VNC_TRACE // record protocol and decoder events in a ring buffer (getTrace)
 
 //#define SLOW_LOOP 250
 
 /// Memory Options
 //#define VNC_SAVE_MEMORY
+//#define VNC_ARENA // all decoder buffers from one block at begin(), see setArena()
 
 // zlib related
 #define VNC_COMPRESS_LEVEL 4
 
 /// VNC Pseudo-encodes
-//#define SET_DESKTOP_SIZE // Set resolution according to display resolution
+//#define SET_DESKTOP_SIZE // Set resolution according to display resolution (server needs ExtendedDesktopSize)
+#define VNC_CONTINUOUS_UPDATES // let the server push updates, flow control via Fence
+
+/// Runtime tuning
+#define VNC_ADAPTIVE_ENCODING // reorder encodings and compress level by measured network and CPU cost
 
 #endif /* VNC_USER_SETUP_LOADED */
 
@@ -79,6 +87,139 @@
 #define VNC_TCP_TIMEOUT 5000
 #endif
 
+#ifndef VNC_CONNECT_TIMEOUT
+// ms for the TCP connect, the handshake itself never blocks loop()
+#define VNC_CONNECT_TIMEOUT 1000
+#endif
+
+#ifdef VNC_CONTINUOUS_UPDATES
+#ifndef VNC_CU_MAX_FRAMES
+// max frames received while a Fence is outstanding before updates are paused
+#define VNC_CU_MAX_FRAMES 2
+#endif
+#endif
+
+#ifndef VNC_UPDATE_PIPELINE_DEPTH
+// number of FramebufferUpdateRequests kept outstanding
+#define VNC_UPDATE_PIPELINE_DEPTH 2
+#endif
+
+#ifndef VNC_RECONNECT_MIN
+// ms before the second connect attempt, doubled after every further failure
+#define VNC_RECONNECT_MIN 100
+#endif
+
+#ifndef VNC_RECONNECT_MAX
+#define VNC_RECONNECT_MAX 2000
+#endif
+
+#ifndef VNC_UPDATE_TIMEOUT
+// ms without FramebufferUpdate after which outstanding requests are considered lost
+#define VNC_UPDATE_TIMEOUT 1000
+#endif
+
+#ifndef VNC_INPUT_LATENCY_RADIUS
+// pixel changes within this distance of the pointer count as reaction to a pointer event
+#define VNC_INPUT_LATENCY_RADIUS 16
+#endif
+
+#ifndef VNC_INPUT_LATENCY_TIMEOUT
+// ms after which a pointer event without pixel change is not measured
+#define VNC_INPUT_LATENCY_TIMEOUT 2000
+#endif
+
+#ifdef VNC_TRACE
+#ifndef VNC_TRACE_SIZE
+// records in the trace ring buffer, 20 byte each
+#define VNC_TRACE_SIZE 256
+#endif
+#endif
+
+#ifdef VNC_ADAPTIVE_ENCODING
+#ifndef VNC_ENCODING_CHECK_INTERVAL
+// ms between checks of the encoding preferences
+#define VNC_ENCODING_CHECK_INTERVAL 5000
+#endif
+#ifndef VNC_ENCODING_MIN_PIXELS
+// smaller rectangles are dominated by headers and not measured
+#define VNC_ENCODING_MIN_PIXELS 256
+#endif
+#endif
+
+#ifndef VNC_CUTTEXT_CHUNK
+// bytes of ServerCutText read and passed to the callback at once, stack buffer
+#define VNC_CUTTEXT_CHUNK 64
+#endif
+
+#ifndef VNC_CUTTEXT_LOOP
+// bytes of ServerCutText read per loop(), the rest is read by the next calls
+#define VNC_CUTTEXT_LOOP (VNC_CUTTEXT_CHUNK * 8)
+#endif
+
+#ifndef VNC_CUTTEXT_MAX
+// default for the bytes of one ServerCutText passed to the callback, the rest is dropped
+#define VNC_CUTTEXT_MAX 1024
+#endif
+
+#ifndef VNC_TX_BUFFER
+// client messages collected for one write, larger messages are written directly
+#define VNC_TX_BUFFER 128
+#endif
+
+#ifndef VNC_INPUT_INTERVAL
+// min ms between two pointer motion events, 0 = once per loop()
+#define VNC_INPUT_INTERVAL 0
+#endif
+
+#ifndef VNC_CLIPBOARD_CHUNK
+// bytes of ClientCutText sent per loop()
+#define VNC_CLIPBOARD_CHUNK 256
+#endif
+
+#ifndef VNC_CLIPBOARD_MAX
+// max text of sendClipboard(), input waits at most VNC_CLIPBOARD_MAX / VNC_CLIPBOARD_CHUNK loop() calls
+#define VNC_CLIPBOARD_MAX 4096
+#endif
+
+#ifndef VNC_CLIPBOARD_HOLD
+// bytes of client messages queued behind a ClientCutText in progress, 8 per key event
+#define VNC_CLIPBOARD_HOLD 256
+#endif
+
+#ifndef VNC_FILL_BATCH
+// fills passed to the display at once, 10 byte each
+#define VNC_FILL_BATCH 32
+#endif
+
+#ifndef VNC_TILED_PANELS
+// max panels of one TiledVNC
+#define VNC_TILED_PANELS 4
+#endif
+
+#ifndef VNC_AREA_BUFFERS
+// Hextile / ZRLE tile buffers in rotation, the decoder fills one while the display sends the other
+#define VNC_AREA_BUFFERS 2
+#endif
+
+#ifndef VNC_SCHEDULER_SESSIONS
+// max sessions of one VNCscheduler
+#define VNC_SCHEDULER_SESSIONS 4
+#endif
+
+#ifndef VNC_SCHEDULER_BUDGET
+// us of decoding per session and round of VNCscheduler::loop()
+#define VNC_SCHEDULER_BUDGET 20000
+#endif
+
+#ifdef VNC_ARENA
+// the arena replaces the allocations per rectangle
+#undef VNC_SAVE_MEMORY
+#ifndef VNC_CURSOR_MAX
+// max width and height of a cursor shape, the sprite is carved from the arena at this size
+#define VNC_CURSOR_MAX 32
+#endif
+#endif
+
 #ifndef VNC_SAVE_MEMORY
 // 15KB raw input buffer
 #define VNC_RAW_BUFFER 15360
@@ -0,0 +1,164 @@
+/*
+ * @file VNC_memory.cpp
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include <stdlib.h>
+#include "VNC_memory.h"
+
+/// header in front of every block, 8 byte to keep the alignment of malloc
+typedef struct {
+    uint32_t size;
+    uint32_t subsystem;
+} vnc_memory_header_t;
+
+static vnc_memory_stats_t memoryStats;
+
+static void memory_add(uint8_t subsystem, uint32_t size) {
+    vnc_memory_counter_t * counters[2] = { &memoryStats.subsystem[subsystem], &memoryStats.total };
+    for(uint8_t i = 0; i < 2; i++) {
+        counters[i]->current += size;
+        counters[i]->allocs++;
+        if(counters[i]->current > counters[i]->peak) {
+            counters[i]->peak = counters[i]->current;
+        }
+    }
+}
+
+static void memory_remove(uint8_t subsystem, uint32_t size) {
+    memoryStats.subsystem[subsystem].current -= size;
+    memoryStats.total.current -= size;
+}
+
+static void memory_failed(uint8_t subsystem) {
+    memoryStats.subsystem[subsystem].failed++;
+    memoryStats.total.failed++;
+}
+
+void * vnc_malloc(uint8_t subsystem, size_t size) {
+    vnc_memory_header_t * header = (vnc_memory_header_t *) malloc(sizeof(vnc_memory_header_t) + size);
+    if(!header) {
+        memory_failed(subsystem);
+        return NULL;
+    }
+    header->size = size;
+    header->subsystem = subsystem;
+    memory_add(subsystem, size);
+    return (header + 1);
+}
+
+void * vnc_realloc(uint8_t subsystem, void * ptr, size_t size) {
+    if(!ptr) {
+        return vnc_malloc(subsystem, size);
+    }
+
+    vnc_memory_header_t * header = ((vnc_memory_header_t *) ptr) - 1;
+    uint32_t oldSize = header->size;
+    vnc_memory_header_t * newHeader = (vnc_memory_header_t *) realloc(header, sizeof(vnc_memory_header_t) + size);
+    if(!newHeader) {
+        // old block is still valid
+        memory_failed(subsystem);
+        return NULL;
+    }
+    memory_remove(newHeader->subsystem, oldSize);
+    newHeader->size = size;
+    newHeader->subsystem = subsystem;
+    memory_add(subsystem, size);
+    return (newHeader + 1);
+}
+
+void vnc_free(void * ptr) {
+    if(!ptr) {
+        return;
+    }
+    vnc_memory_header_t * header = ((vnc_memory_header_t *) ptr) - 1;
+    memory_remove(header->subsystem, header->size);
+    free(header);
+}
+
+const vnc_memory_stats_t & vnc_memory_stats(void) {
+    return memoryStats;
+}
+
+VNCarena::VNCarena() {
+    block = NULL;
+    blockSize = 0;
+    offset = 0;
+    owned = false;
+}
+
+VNCarena::~VNCarena() {
+    end();
+}
+
+/**
+ * allocate the block from the heap
+ */
+bool VNCarena::begin(size_t size) {
+    end();
+    block = (uint8_t *) vnc_malloc(VNC_MEM_ARENA, size);
+    if(!block) {
+        return false;
+    }
+    blockSize = size;
+    owned = true;
+    return true;
+}
+
+/**
+ * use memory of the caller, it must stay valid as long as the arena is used
+ */
+bool VNCarena::begin(uint8_t * _block, size_t size) {
+    end();
+    if(!_block) {
+        return false;
+    }
+    size_t skip = (4 - ((uintptr_t) _block & 3)) & 3;
+    if(size < skip) {
+        return false;
+    }
+    block = _block + skip;
+    blockSize = size - skip;
+    return true;
+}
+
+void VNCarena::end(void) {
+    if(owned) {
+        vnc_free(block);
+    }
+    block = NULL;
+    blockSize = 0;
+    offset = 0;
+    owned = false;
+}
+
+void * VNCarena::alloc(size_t size) {
+    size = align(size);
+    if(!block || (blockSize - offset) < size) {
+        return NULL;
+    }
+    void * ptr = block + offset;
+    offset += size;
+    return ptr;
+}
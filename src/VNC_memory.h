@@ -0,0 +1,93 @@
+/*
+ * @file VNC_memory.h
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef VNC_MEMORY_H_
+#define VNC_MEMORY_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+enum {
+    VNC_MEM_ZLIB,           // zin / zout
+    VNC_MEM_RAW,            // Raw input buffer
+    VNC_MEM_HEXTILE,        // Hextile subrect buffer
+    VNC_MEM_FRAMEBUFFER,    // FrameBuffer for Hextile and ZRLE tiles
+    VNC_MEM_CURSOR,         // RichCursor / XCursor data and mask
+    VNC_MEM_CUTTEXT,        // ClientCutText
+    VNC_MEM_PROTOCOL,       // security types, reason strings, server name
+    VNC_MEM_ARENA,          // VNCarena block
+    VNC_MEM_SUBSYSTEMS
+};
+
+typedef struct {
+    uint32_t current;       // bytes in use
+    uint32_t peak;          // high watermark of current
+    uint32_t allocs;        // successful allocations
+    uint32_t failed;        // failed allocations
+} vnc_memory_counter_t;
+
+typedef struct {
+    vnc_memory_counter_t subsystem[VNC_MEM_SUBSYSTEMS];
+    vnc_memory_counter_t total;
+} vnc_memory_stats_t;
+
+/**
+ * malloc / realloc / free with accounting per subsystem,
+ * memory from vnc_malloc must be released with vnc_free
+ */
+void * vnc_malloc(uint8_t subsystem, size_t size);
+void * vnc_realloc(uint8_t subsystem, void * ptr, size_t size);
+void vnc_free(void * ptr);
+
+const vnc_memory_stats_t & vnc_memory_stats(void);
+
+/**
+ * bump allocator over one block, the buffers are never freed on their own
+ */
+class VNCarena {
+    public:
+        VNCarena();
+        ~VNCarena();
+
+        bool begin(size_t size);
+        bool begin(uint8_t * block, size_t size);
+        void end(void);
+
+        void * alloc(size_t size);
+
+        size_t size(void) { return blockSize; }
+        size_t used(void) { return offset; }
+
+        static size_t align(size_t size) { return (size + 3) & ~((size_t) 3); }
+
+    private:
+        uint8_t * block;
+        size_t blockSize;
+        size_t offset;
+        bool owned;
+};
+
+#endif /* VNC_MEMORY_H_ */
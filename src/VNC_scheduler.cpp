@@ -0,0 +1,211 @@
+/*
+ * @file VNC_scheduler.cpp
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "VNC_scheduler.h"
+#include "VNC_memory.h"
+
+VNCscheduler::VNCscheduler() {
+    sessionCount = 0;
+    next = 0;
+    connectNext = 0;
+    leaseNext = 0;
+    budgetUs = VNC_SCHEDULER_BUDGET;
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    zin = NULL;
+    zout = NULL;
+    inflateOwner = NULL;
+#endif
+}
+
+/**
+ * the sessions are still alive, see class comment
+ */
+VNCscheduler::~VNCscheduler() {
+    while(sessionCount) {
+        remove(sessions[0].vnc);
+    }
+#if (defined(VNC_ZLIB) || defined(VNC_ZRLE)) && !defined(VNC_ARENA)
+    vnc_free(zin);
+    vnc_free(zout);
+#endif
+}
+
+/**
+ * add a session, call before its begin(), see class comment for a connected session
+ */
+bool VNCscheduler::add(arduinoVNC * session) {
+    if(!session || sessionCount >= VNC_SCHEDULER_SESSIONS) {
+        return false;
+    }
+    session->setBufferPool(&pool);
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    // no Zlib and ZRLE until the session gets the lease
+    session->setInflateBuffers(NULL, NULL);
+#endif
+    sessions[sessionCount].vnc = session;
+    sessions[sessionCount].creditUs = 0;
+    sessionCount++;
+    return true;
+}
+
+/**
+ * the session gets its own buffer pool back and runs without Zlib and ZRLE
+ * until it gets inflate buffers with setInflateBuffers(), see class comment
+ */
+void VNCscheduler::remove(arduinoVNC * session) {
+    for(uint8_t i = 0; i < sessionCount; i++) {
+        if(sessions[i].vnc != session) {
+            continue;
+        }
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+        if(inflateOwner == session) {
+            session->setInflateBuffers(NULL, NULL);
+            inflateOwner = NULL;
+        }
+#endif
+        session->setBufferPool(NULL);
+        sessionCount--;
+        for(; i < sessionCount; i++) {
+            sessions[i] = sessions[i + 1];
+        }
+        next = 0;
+        connectNext = 0;
+        leaseNext = 0;
+        return;
+    }
+}
+
+void VNCscheduler::setBudget(uint32_t us) {
+    budgetUs = max(us, (uint32_t) 1);
+}
+
+/**
+ * one round over all sessions, the first session changes every round.
+ * the TCP connect blocks, so it is started for at most one session after the round
+ */
+void VNCscheduler::loop(void) {
+#ifdef VNC_ARENA
+    if(!_arena_init()) {
+        return;
+    }
+#endif
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    _inflate_lease();
+#endif
+
+    for(uint8_t n = 0; n < sessionCount; n++) {
+        vnc_session_t * session = &sessions[(next + n) % sessionCount];
+
+        // unused time is not saved up, debt is paid back
+        session->creditUs = min(session->creditUs + (int32_t) budgetUs, (int32_t) budgetUs);
+        if(session->creditUs <= 0 || !session->vnc->connected()) {
+            continue;
+        }
+
+        do {
+            unsigned long start = micros();
+            session->vnc->setLoopBudget(session->creditUs);
+            session->vnc->loop();
+            session->creditUs -= (int32_t) (micros() - start);
+        } while(session->creditUs > 0 && session->vnc->pending());
+    }
+
+    for(uint8_t n = 0; n < sessionCount; n++) {
+        uint8_t i = (connectNext + n) % sessionCount;
+        if(!sessions[i].vnc->connected()) {
+            sessions[i].vnc->loop();
+            connectNext = (i + 1) % sessionCount;
+            break;
+        }
+    }
+
+    if(sessionCount) {
+        next = (next + 1) % sessionCount;
+    }
+}
+
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+/**
+ * the inflate stream lives as long as the connection,
+ * the lease only moves when the owner is disconnected, the sessions get it in turn
+ */
+void VNCscheduler::_inflate_lease(void) {
+    if(inflateOwner && !inflateOwner->connected()) {
+        inflateOwner->setInflateBuffers(NULL, NULL);
+        inflateOwner = NULL;
+    }
+
+    if(inflateOwner || !sessionCount) {
+        return;
+    }
+
+#ifndef VNC_ARENA
+    if(!zin) {
+        zin = (uint8_t *) vnc_malloc(VNC_MEM_ZLIB, ZRLE_INPUT_BUFFER);
+    }
+    if(!zout) {
+        zout = (uint8_t *) vnc_malloc(VNC_MEM_ZLIB, ZRLE_OUTPUT_BUFFER);
+    }
+#endif
+    if(!zin || !zout) {
+        return;
+    }
+
+    uint8_t i = leaseNext % sessionCount;
+    leaseNext = (i + 1) % sessionCount;
+    inflateOwner = sessions[i].vnc;
+    inflateOwner->setInflateBuffers(zin, zout);
+}
+#endif
+
+#ifdef VNC_ARENA
+/**
+ * carve the shared pool and the inflate buffers, only done once.
+ * false if the block can not be allocated, the sessions are not run then
+ */
+bool VNCscheduler::_arena_init(void) {
+    if(arena.used()) {
+        return true;
+    }
+
+    size_t size = VNCbufferPool::size();
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    size += VNCarena::align(ZRLE_INPUT_BUFFER);
+    size += VNCarena::align(ZRLE_OUTPUT_BUFFER);
+#endif
+    if(!arena.begin(size)) {
+        DEBUG_VNC("[VNCscheduler] malloc of %zu failed!\n", size);
+        return false;
+    }
+
+    pool.begin(&arena);
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+    zin = (uint8_t *) arena.alloc(ZRLE_INPUT_BUFFER);
+    zout = (uint8_t *) arena.alloc(ZRLE_OUTPUT_BUFFER);
+#endif
+    return true;
+}
+#endif
@@ -0,0 +1,88 @@
+/*
+ * @file VNC_scheduler.h
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef VNC_SCHEDULER_H_
+#define VNC_SCHEDULER_H_
+
+#include "VNC.h"
+
+/**
+ * services several arduinoVNC from one task.
+ * every session gets VNC_SCHEDULER_BUDGET us of decoding per round, checked before each rect,
+ * a rect that takes longer is paid back in the next rounds. a rect is read as a whole,
+ * when the server stalls in the middle of one the session blocks for up to VNC_TCP_TIMEOUT.
+ * a disconnected session only connects after the round, one per round,
+ * the handshake then runs step by step without waiting for the server.
+ * all sessions share one decoder buffer pool, the inflate buffers are leased
+ * to one session at a time, the others run without Zlib and ZRLE.
+ * the lease moves on in turn when its owner is disconnected.
+ * add() and remove() take the inflate buffers away from the session,
+ * a connected session that used Zlib or ZRLE is disconnected and reconnects in its loop().
+ * with VNC_ARENA the pool and the inflate buffers are carved from one block by the first loop().
+ * the sessions must outlive the scheduler or be removed before they are destroyed.
+ */
+class VNCscheduler {
+    public:
+        VNCscheduler();
+        ~VNCscheduler();
+
+        bool add(arduinoVNC * session);
+        void remove(arduinoVNC * session);
+        uint8_t count(void) { return sessionCount; }
+
+        void setBudget(uint32_t us);
+
+        void loop(void);
+
+    private:
+        typedef struct {
+            arduinoVNC * vnc;
+            int32_t creditUs;
+        } vnc_session_t;
+
+        vnc_session_t sessions[VNC_SCHEDULER_SESSIONS];
+        uint8_t sessionCount;
+        uint8_t next;           // first session of the next round
+        uint8_t connectNext;    // first session to look at for the next connect
+        uint8_t leaseNext;      // first session to look at for the inflate lease
+        uint32_t budgetUs;
+
+#ifdef VNC_ARENA
+        VNCarena arena;
+        bool _arena_init(void);
+#endif
+        VNCbufferPool pool;
+
+#if defined(VNC_ZLIB) || defined(VNC_ZRLE)
+        uint8_t * zin;
+        uint8_t * zout;
+        arduinoVNC * inflateOwner;
+
+        void _inflate_lease(void);
+#endif
+};
+
+#endif /* VNC_SCHEDULER_H_ */
@@ -0,0 +1,99 @@
+/*
+ * @file VNC_trace.cpp
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#include "VNC_trace.h"
+
+#ifdef VNC_TRACE
+
+VNCtrace::VNCtrace() {
+    clear();
+}
+
+void VNCtrace::clear(void) {
+    next = 0;
+    used = 0;
+}
+
+uint16_t VNCtrace::count(void) {
+    return used;
+}
+
+/**
+ * record n, oldest first
+ */
+const vnc_trace_record_t * VNCtrace::get(uint16_t n) {
+    if(n >= used) {
+        return NULL;
+    }
+    return &records[(next + VNC_TRACE_SIZE - used + n) % VNC_TRACE_SIZE];
+}
+
+/**
+ * binary dump: "VNCT", record count and record size (uint16 each), records oldest first in CPU byte order
+ */
+void VNCtrace::dump(Print & out) {
+    uint16_t header[2] = { used, sizeof(vnc_trace_record_t) };
+    out.write((const uint8_t *) "VNCT", 4);
+    out.write((const uint8_t *) &header, sizeof(header));
+    for(uint16_t i = 0; i < used; i++) {
+        out.write((const uint8_t *) get(i), sizeof(vnc_trace_record_t));
+    }
+}
+
+/**
+ * dump in Chrome trace event format, open with chrome://tracing or ui.perfetto.dev
+ */
+void VNCtrace::dumpChromeTrace(Print & out) {
+    static const char * names[VNC_TRACE_EVENTS] = {
+        "message", "frame", "frame", "rect", "rect", "inflate", "inflate", "display", "request", "pointer"
+    };
+    static const char phases[VNC_TRACE_EVENTS] = {
+        'i', 'B', 'E', 'B', 'E', 'B', 'E', 'X', 'i', 'i'
+    };
+
+    out.print("{\"traceEvents\":[\n");
+    for(uint16_t i = 0; i < used; i++) {
+        const vnc_trace_record_t * r = get(i);
+        if(r->event >= VNC_TRACE_EVENTS) {
+            continue;
+        }
+        uint32_t us = r->us;
+        if(r->event == VNC_TRACE_DISPLAY) {
+            us -= r->arg;
+        }
+        out.printf("%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,\"tid\":1", (i ? "," : ""), names[r->event], phases[r->event], us);
+        if(r->event == VNC_TRACE_DISPLAY) {
+            out.printf(",\"dur\":%u", r->arg);
+        }
+        if(phases[r->event] == 'i') {
+            out.print(",\"s\":\"t\"");
+        }
+        out.printf(",\"args\":{\"x\":%u,\"y\":%u,\"w\":%u,\"h\":%u,\"arg\":%d}}\n", r->x, r->y, r->w, r->h, (int32_t) r->arg);
+    }
+    out.print("]}\n");
+}
+
+#endif /* VNC_TRACE */
@@ -0,0 +1,100 @@
+/*
+ * @file VNC_trace.h
+ * @date 19.10.2026
+ * @author Markus Sattler
+ *
+ * Copyright (c) 2026 Markus Sattler. All rights reserved.
+ * This file is part of the VNC client for Arduino.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; version 2 of the License
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, a copy can be downloaded from
+ * http://www.gnu.org/licenses/gpl.html, or obtained by writing to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA 02110-1301, USA.
+ *
+ *
+ */
+
+#ifndef VNC_TRACE_H_
+#define VNC_TRACE_H_
+
+#include "VNC_config.h"
+
+#ifdef VNC_TRACE
+
+#include <Arduino.h>
+
+enum {
+    VNC_TRACE_MESSAGE,          // arg: server message type
+    VNC_TRACE_FRAME_START,      // arg: number of rectangles
+    VNC_TRACE_FRAME_END,
+    VNC_TRACE_RECT_START,       // rect, arg: encoding
+    VNC_TRACE_RECT_END,         // rect, arg: wire bytes
+    VNC_TRACE_INFLATE_START,    // arg: compressed bytes available
+    VNC_TRACE_INFLATE_END,      // arg: decompressed bytes
+    VNC_TRACE_DISPLAY,          // rect, arg: duration in us
+    VNC_TRACE_REQUEST,          // rect, arg: incremental
+    VNC_TRACE_POINTER,          // x, y, arg: button mask
+    VNC_TRACE_EVENTS
+};
+
+typedef struct {
+    uint32_t us;
+    uint16_t event;
+    uint16_t x;
+    uint16_t y;
+    uint16_t w;
+    uint16_t h;
+    uint32_t arg;
+} vnc_trace_record_t;
+
+class VNCtrace {
+    public:
+        VNCtrace();
+
+        void add(uint16_t event, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint32_t arg) {
+            vnc_trace_record_t * r = &records[next];
+            r->us = micros();
+            r->event = event;
+            r->x = x;
+            r->y = y;
+            r->w = w;
+            r->h = h;
+            r->arg = arg;
+            next = (next + 1) % VNC_TRACE_SIZE;
+            if(used < VNC_TRACE_SIZE) {
+                used++;
+            }
+        }
+
+        void clear(void);
+        uint16_t count(void);
+        const vnc_trace_record_t * get(uint16_t n);
+
+        void dump(Print & out);
+        void dumpChromeTrace(Print & out);
+
+    private:
+        vnc_trace_record_t records[VNC_TRACE_SIZE];
+        uint16_t next;
+        uint16_t used;
+};
+
+#define VNC_TRACE_EVENT(...) trace.add(__VA_ARGS__)
+
+#else
+
+#define VNC_TRACE_EVENT(...)
+
+#endif /* VNC_TRACE */
+
+#endif /* VNC_TRACE_H_ */
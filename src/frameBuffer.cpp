@@ -38,6 +38,7 @@ FrameBuffer::FrameBuffer() {
     h = 0;
     size = 0;
     buffer = 0;
+    external = false;
 }
 
 FrameBuffer::~FrameBuffer() {
@@ -54,11 +55,15 @@ bool FrameBuffer::begin(uint32_t _w, uint32_t _h) {
     //DEBUG_VNC("[FrameBuffer::begin] w: %d h: %d size: %d newSize: %d buffer: 0x%08X Heap: %d\n", w, h, size, newSize, buffer, ESP.getFreeHeap());
     //delay(10);
 
+    if(external) {
+        return (size >= newSize);
+    }
+
     if(buffer) {
         if((size < newSize)) {
             //DEBUG_VNC("[FrameBuffer::begin] (size < newSize)  realloc... <--------------------------------------\n");
             //delay(10);
-            uint8_t * newbuffer = (uint8_t *) realloc(buffer, newSize);
+            uint8_t * newbuffer = (uint8_t *) vnc_realloc(VNC_MEM_FRAMEBUFFER, buffer, newSize);
             //DEBUG_VNC("[FrameBuffer::begin] newbuffer: 0x%08X\n", newbuffer);
             if(!newbuffer) {
                 freeBuffer();
@@ -71,7 +76,7 @@ bool FrameBuffer::begin(uint32_t _w, uint32_t _h) {
         return true;
     }
 
-    buffer = (uint8_t *) malloc(newSize);
+    buffer = (uint8_t *) vnc_malloc(VNC_MEM_FRAMEBUFFER, newSize);
     if(buffer) {
         size = newSize;
         return true;
@@ -87,10 +92,23 @@ uint8_t * FrameBuffer::getPtr(void) {
     return buffer;
 }
 
+/**
+ * use a fixed buffer, begin() will never allocate
+ */
+void FrameBuffer::setBuffer(uint8_t * _buffer, uint32_t _size) {
+    freeBuffer();
+    buffer = _buffer;
+    size = _size;
+    external = true;
+}
+
 void FrameBuffer::freeBuffer(void) {
+    if(external) {
+        return;
+    }
     if(buffer) {
         //DEBUG_VNC("[FrameBuffer::draw_rect] free: 0x%08X\n", buffer);
-        free(buffer);
+        vnc_free(buffer);
         buffer = 0;
         size = 0;
         //DEBUG_VNC("[FrameBuffer::draw_rect] free: 0x%08X Done.\n", buffer);
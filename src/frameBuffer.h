@@ -28,6 +28,7 @@
 #define ARDUINOVNC_SRC_FB_H_
 
 #include <Arduino.h>
+#include "VNC_memory.h"
 
 #ifdef WORDS_BIGENDIAN
 #define Swap16IfLE(s) (s)
@@ -40,6 +41,7 @@ class FrameBuffer {
         FrameBuffer();
         ~FrameBuffer();
         bool begin(uint32_t _w, uint32_t _h);
+        void setBuffer(uint8_t * _buffer, uint32_t _size);
 
         uint8_t * getPtr(void);
         void freeBuffer(void);
@@ -52,6 +54,7 @@ class FrameBuffer {
         uint32_t h;
         uint32_t size;
         uint8_t * buffer;
+        bool external;
 
 };
 
@@ -515,6 +515,7 @@ typedef struct _rfbInteractionCapsMsg {
 
 #define rfbEncodingLastRect        0xFFFFFF20
 #define rfbEncodingNewFBSize       0xFFFFFF21
+#define rfbEncodingExtendedDesktopSize 0xFFFFFECC
 
 #define rfbEncodingQualityLevel0   0xFFFFFFE0
 #define rfbEncodingQualityLevel1   0xFFFFFFE1
@@ -1294,6 +1295,40 @@ typedef struct _rfbSetDesktopSizeMsg
 
 #define sz_rfbSetDesktopSizeMsg (24)
 
+/*-----------------------------------------------------------------------------
+ * ExtendedDesktopSize - pseudo rectangle, x is the reason, y the status and
+ * w / h the new framebuffer size
+ */
+
+#define rfbEDSReasonServer 0
+#define rfbEDSReasonClient 1
+#define rfbEDSReasonOtherClient 2
+
+#define rfbEDSResultSuccess 0
+
+typedef struct _rfbExtDesktopSizeMsg
+{
+    CARD8 numberOfScreens;
+    CARD8 pad[3];
+
+    /* Followed by numberOfScreens * rfbExtDesktopScreen */
+
+} rfbExtDesktopSizeMsg;
+
+#define sz_rfbExtDesktopSizeMsg (4)
+
+typedef struct _rfbExtDesktopScreen
+{
+    CARD32 id;
+    CARD16 x;
+    CARD16 y;
+    CARD16 width;
+    CARD16 height;
+    CARD32 flags;
+} rfbExtDesktopScreen;
+
+#define sz_rfbExtDesktopScreen (16)
+
 /*-----------------------------------------------------------------------------
  * FixColourMapEntries - when the pixel format uses a "colour map", fix
  * read-only colour map entries.